@@ -0,0 +1,13 @@
+#include <am.h>
+#include <nemu.h>
+
+#define UART_LSR (SERIAL_PORT + 5)
+#define LSR_DR   0x01
+
+void __am_uart_tx(AM_UART_TX_T *tx) {
+  outb(SERIAL_PORT, tx->data);
+}
+
+void __am_uart_rx(AM_UART_RX_T *rx) {
+  rx->data = (inb(UART_LSR) & LSR_DR) ? inb(SERIAL_PORT) : -1;
+}
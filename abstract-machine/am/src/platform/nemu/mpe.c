@@ -2,17 +2,42 @@
 #include <stdatomic.h>
 #include <klib-macros.h>
 
+#define MPE_STACK_SIZE (32 * 1024)
+
+int __am_ncpu = 1;            // set by start.S if NEMU has multiple harts
+uintptr_t __am_mpe_stack = 0; // the other harts wait in start.S until it is set
+static void (*mpe_entry)() = NULL;
+
 bool mpe_init(void (*entry)()) {
+  mpe_entry = entry;
+  if (__am_ncpu > 1) {
+    // the stacks of the other harts are taken from the end of the heap
+    uintptr_t top = (uintptr_t)heap.end;
+    heap.end = (void *)(top - (__am_ncpu - 1) * MPE_STACK_SIZE);
+    __atomic_store_n(&__am_mpe_stack, top, __ATOMIC_RELEASE);
+  }
   entry();
   panic("MPE entry returns");
 }
 
+// the other harts come here from start.S
+void __am_mpe_secondary() {
+  mpe_entry();
+  panic("MPE entry returns");
+}
+
 int cpu_count() {
-  return 1;
+  return __am_ncpu;
 }
 
 int cpu_current() {
+#ifdef __riscv
+  int id;
+  asm volatile ("mv %0, tp" : "=r"(id));
+  return id;
+#else
   return 0;
+#endif
 }
 
 int atomic_xchg(int *addr, int newval) {
@@ -14,7 +14,12 @@ static const char mainargs[MAINARGS_MAX_LEN] = TOSTRING(MAINARGS_PLACEHOLDER); /
 void putch(char ch) {
 }
 
+# define npc_trap(code) asm volatile("mv a0, %0; ebreak" : :"r"(code))
+
 void halt(int code) {
+  npc_trap(code);
+
+  // should not reach here
   while (1);
 }
 
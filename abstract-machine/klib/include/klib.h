@@ -16,6 +16,7 @@ void  *memset    (void *s, int c, size_t n);
 void  *memcpy    (void *dst, const void *src, size_t n);
 void  *memmove   (void *dst, const void *src, size_t n);
 int    memcmp    (const void *s1, const void *s2, size_t n);
+void  *memchr    (const void *s, int c, size_t n);
 size_t strlen    (const char *s);
 char  *strcat    (char *dst, const char *src);
 char  *strcpy    (char *dst, const char *src);
@@ -4,7 +4,45 @@
 
 #if !defined(__ISA_NATIVE__) || defined(__NATIVE_USE_KLIB__)
 
+#if defined(__NEMU_HOSTCALL__) && defined(__riscv)
+// let NEMU do the bulk memory operations on the host, see CONFIG_HOSTCALL
+enum { HOSTCALL_MEMCPY = 1, HOSTCALL_MEMSET = 2 };
+#define hostcall(id, x, y, z) ({ \
+  register uintptr_t a0 asm("a0") = (uintptr_t)(x); \
+  register uintptr_t a1 asm("a1") = (uintptr_t)(y); \
+  register uintptr_t a2 asm("a2") = (uintptr_t)(z); \
+  asm volatile (".insn i 0x0b, 0, x0, x0, %3" : "+r"(a0) : "r"(a1), "r"(a2), "i"(id) : "memory"); \
+  a0 == 0; })
+#else
+#define hostcall(id, x, y, z) false
+#endif
+
+#ifdef __riscv_zbb
+// Scan a word at a time with orc.b of Zbb, which sets every non-zero byte
+// to 0xff and every zero byte to 0. An aligned word never crosses a page,
+// so reading the whole word after the end of a string is safe.
+#define WSIZE sizeof(uintptr_t)
+#define ALIGNED(p) (((uintptr_t)(p) & (WSIZE - 1)) == 0)
+static inline uintptr_t orc_b(uintptr_t x) {
+  uintptr_t r;
+  asm ("orc.b %0, %1" : "=r"(r) : "r"(x));
+  return r;
+}
+#define HAS_ZERO(w) (orc_b(w) != ~(uintptr_t)0)
+// the index of the first zero byte in w (little-endian)
+#define FIRST_ZERO(w) (__builtin_ctzl(~orc_b(w)) / 8)
+#endif
+
 size_t strlen(const char *s) {
+#ifdef __riscv_zbb
+  const char *p = s;
+  for (; !ALIGNED(p); p ++) {
+    if (*p == '\0') return p - s;
+  }
+  const uintptr_t *w = (const uintptr_t *)p;
+  while (!HAS_ZERO(*w)) w ++;
+  return (const char *)w - s + FIRST_ZERO(*w);
+#endif
   size_t count = 0;
   while (*s != '\0') {
     count++;
@@ -60,6 +98,18 @@ char *strcat(char *dst, const char *src) {
 }
 
 int strcmp(const char *s1, const char *s2) {
+#ifdef __riscv_zbb
+  // compare by words until a word differs or has the end of s1
+  if (ALIGNED((uintptr_t)s1 ^ (uintptr_t)s2)) {
+    for (; !ALIGNED(s1); s1 ++, s2 ++) {
+      if (*s1 == '\0' || *s1 != *s2) return *(unsigned char *)s1 - *(unsigned char *)s2;
+    }
+    const uintptr_t *w1 = (const uintptr_t *)s1, *w2 = (const uintptr_t *)s2;
+    while (*w1 == *w2 && !HAS_ZERO(*w1)) { w1 ++; w2 ++; }
+    s1 = (const char *)w1;
+    s2 = (const char *)w2;
+  }
+#endif
   while (*s1 != '\0' && *s2 != '\0' && *s1 == *s2) {
     s1++;
     s2++;
@@ -80,6 +130,7 @@ int strncmp(const char *s1, const char *s2, size_t n) {
 }
 
 void *memset(void *s, int c, size_t n) {
+  if (hostcall(HOSTCALL_MEMSET, s, (unsigned char)c, n)) return s;
   unsigned char *ptr = (unsigned char *)s;
   unsigned char value = (unsigned char)c;
   for (size_t i = 0; i < n; i++) {
@@ -95,6 +146,8 @@ void *memmove(void *dst, const void *src, size_t n) {
   if (d == s) {
     return dst;
   }
+  // NEMU handles the overlapping
+  if (hostcall(HOSTCALL_MEMCPY, dst, src, n)) return dst;
 
   // 判断内存区域是否重叠
   if (d < s || d >= s + n) {
@@ -112,6 +165,7 @@ void *memmove(void *dst, const void *src, size_t n) {
 }
 
 void *memcpy(void *out, const void *in, size_t n) {
+  if (hostcall(HOSTCALL_MEMCPY, out, in, n)) return out;
   unsigned char *d = (unsigned char *)out;
   const unsigned char *s = (const unsigned char *)in;
   for (size_t i = 0; i < n; i++) {
@@ -135,4 +189,24 @@ int memcmp(const void *s1, const void *s2, size_t n) {
   return 0;
 }
 
+void *memchr(const void *s, int c, size_t n) {
+  const unsigned char *p = (const unsigned char *)s;
+  unsigned char ch = (unsigned char)c;
+#ifdef __riscv_zbb
+  for (; n > 0 && !ALIGNED(p); p ++, n --) {
+    if (*p == ch) return (void *)p;
+  }
+  // a byte equal to ch is a zero byte after the xor
+  uintptr_t pattern = ch * (~(uintptr_t)0 / 0xff);
+  for (; n >= WSIZE; p += WSIZE, n -= WSIZE) {
+    uintptr_t w = *(const uintptr_t *)p ^ pattern;
+    if (HAS_ZERO(w)) return (void *)(p + FIRST_ZERO(w));
+  }
+#endif
+  for (; n > 0; p ++, n --) {
+    if (*p == ch) return (void *)p;
+  }
+  return NULL;
+}
+
 #endif
@@ -5,6 +5,7 @@ AM_SRCS := platform/nemu/trm.c \
            platform/nemu/ioe/gpu.c \
            platform/nemu/ioe/audio.c \
            platform/nemu/ioe/disk.c \
+           platform/nemu/ioe/uart.c \
            platform/nemu/mpe.c
 
 CFLAGS    += -fdata-sections -ffunction-sections
@@ -17,6 +18,9 @@ NEMU_CONFIG = $(NEMU_HOME)/.config
 ifneq ($(shell grep -qs "CONFIG_FTRACE=y" $(NEMU_CONFIG) && echo y),)
   NEMUFLAGS += --elf $(IMAGE).elf
 endif
+ifneq ($(shell grep -qs "CONFIG_HOSTCALL=y" $(NEMU_CONFIG) && echo y),)
+  CFLAGS += -D__NEMU_HOSTCALL__
+endif
 
 MAINARGS_MAX_LEN = 64
 MAINARGS_PLACEHOLDER = the_insert-arg_rule_in_Makefile_will_insert_mainargs_here
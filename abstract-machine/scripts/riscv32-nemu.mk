@@ -1,7 +1,9 @@
 include $(AM_HOME)/scripts/isa/riscv.mk
 include $(AM_HOME)/scripts/platform/nemu.mk
 CFLAGS  += -DISA_H=\"riscv/riscv.h\"
-COMMON_CFLAGS += -march=rv32im_zicsr -mabi=ilp32   # overwrite
+# the bit-manipulation extensions if NEMU supports them, see CONFIG_RV_ZB
+RV_ZB = $(if $(shell grep -qs "CONFIG_RV_ZB=y" $(NEMU_CONFIG) && echo y),_zba_zbb)
+COMMON_CFLAGS += -march=rv32imac_zicsr$(RV_ZB) -mabi=ilp32 # overwrite
 LDFLAGS       += -melf32lriscv                     # overwrite
 
 AM_SRCS += riscv/nemu/start.S \
@@ -26,4 +26,20 @@ void invalid_inst(vaddr_t thispc);
 #define NEMUTRAP(thispc, code) set_nemu_state(NEMU_END, thispc, code)
 #define INV(thispc) invalid_inst(thispc)
 
+#ifdef CONFIG_GDB_STUB
+// The breakpoints of gdb. The ISA checks them before an instruction which
+// is not in the decode cache, and then returns -1 from isa_exec_once()
+// without executing it.
+extern int nr_breakpoint;
+bool breakpoint_check(vaddr_t pc);
+#define BREAKPOINT_HIT(pc) (unlikely(nr_breakpoint > 0) && breakpoint_check(pc))
+#else
+#define BREAKPOINT_HIT(pc) false
+#endif
+
+// the ids of the hostcall instruction, keep them the same as klib
+enum { HOSTCALL_MEMCPY = 1, HOSTCALL_MEMSET = 2 };
+// return 0 on success, the guest should do it by itself otherwise
+word_t hostcall(vaddr_t pc, int id, word_t a0, word_t a1, word_t a2);
+
 #endif
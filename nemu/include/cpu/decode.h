@@ -23,6 +23,7 @@ typedef struct Decode {
   vaddr_t snpc; // static next pc
   vaddr_t dnpc; // dynamic next pc
   ISADecodeInfo isa;
+  IFDEF(CONFIG_INST_FUSION, bool can_fuse); // may also execute the next instruction
   IFDEF(CONFIG_ITRACE, char logbuf[128]);
 } Decode;
 
@@ -87,10 +88,20 @@ finish:
 
 
 // --- pattern matching wrappers for decode ---
+#ifdef CONFIG_DECODE_CACHE
+// Let the ISA remember the address of the matched pattern with
+// INSTPAT_HIT(s, label), so that it can jump there directly next time.
+#define INSTPAT_CACHE(s) \
+  INSTPAT_HIT(s, &&concat(__instpat_hit_, __LINE__)); concat(__instpat_hit_, __LINE__):
+#else
+#define INSTPAT_CACHE(s)
+#endif
+
 #define INSTPAT(pattern, ...) do { \
   uint64_t key, mask, shift; \
   pattern_decode(pattern, STRLEN(pattern), &key, &mask, &shift); \
   if ((((uint64_t)INSTPAT_INST(s) >> shift) & mask) == key) { \
+    INSTPAT_CACHE(s); \
     INSTPAT_MATCH(s, ##__VA_ARGS__); \
     goto *(__instpat_end); \
   } \
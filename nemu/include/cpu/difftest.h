@@ -19,26 +19,44 @@
 #include <common.h>
 #include <difftest-def.h>
 
+struct Decode;
+
 #ifdef CONFIG_DIFFTEST
 void difftest_skip_ref();
 void difftest_skip_dut(int nr_ref, int nr_dut);
 void difftest_set_patch(void (*fn)(void *arg), void *arg);
-void difftest_step(vaddr_t pc, vaddr_t npc);
+void difftest_step(struct Decode *s, vaddr_t npc);
+void difftest_sync();
 void difftest_detach();
 void difftest_attach();
+void difftest_dma(paddr_t addr, size_t n);
+void difftest_intr(word_t NO);
 #else
 static inline void difftest_skip_ref() {}
 static inline void difftest_skip_dut(int nr_ref, int nr_dut) {}
 static inline void difftest_set_patch(void (*fn)(void *arg), void *arg) {}
-static inline void difftest_step(vaddr_t pc, vaddr_t npc) {}
+static inline void difftest_step(struct Decode *s, vaddr_t npc) {}
+static inline void difftest_sync() {}
 static inline void difftest_detach() {}
 static inline void difftest_attach() {}
+static inline void difftest_dma(paddr_t addr, size_t n) {}
+static inline void difftest_intr(word_t NO) {}
+#endif
+
+#ifdef CONFIG_DIFFTEST_ASYNC
+void difftest_commit_store(paddr_t addr, int len, word_t data);
+#endif
+
+#ifdef CONFIG_DIFFTEST_CHECKPOINT
+void difftest_checkpoint();
+void difftest_checkpoint_replay();
 #endif
 
 extern void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction);
 extern void (*ref_difftest_regcpy)(void *dut, bool direction);
 extern void (*ref_difftest_exec)(uint64_t n);
 extern void (*ref_difftest_raise_intr)(uint64_t NO);
+extern void (*ref_difftest_exec_block)(uint64_t last_pc, uint64_t n);
 
 static inline bool difftest_check_reg(const char *name, vaddr_t pc, word_t ref, word_t dut) {
   if (ref != dut) {
@@ -0,0 +1,47 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __DEVICE_EVENT_H__
+#define __DEVICE_EVENT_H__
+
+#include <common.h>
+
+typedef void (*event_handler_t) ();
+
+// number of guest instructions at which the earliest event is due,
+// the CPU loop only compares against it
+extern uint64_t next_event;
+
+// Call `handler` after `delay` guest instructions, and then every `period`
+// instructions if `period` is not 0.
+void add_inst_event(uint64_t delay, uint64_t period, event_handler_t handler);
+// The same, but `delay` and `period` are in us of host time. These events
+// are checked together, so reading the host time is also rare.
+void add_host_event(uint64_t delay, uint64_t period, event_handler_t handler);
+
+void event_update();
+// make the CPU loop call event_update() after the current instruction
+static inline void event_kick() { next_event = 0; }
+
+// time in us seen by the guest, which is the host time unless TIMER_VIRTUAL
+uint64_t get_guest_time();
+// the same as add_host_event(), but in guest time
+void add_guest_event(uint64_t delay, uint64_t period, event_handler_t handler);
+// jump the guest time forward to the next event, for a guest waiting for it
+void event_skip_idle();
+// called by a device when the guest polls it and nothing has changed
+void event_idle_poll();
+
+#endif
@@ -53,4 +53,10 @@ void add_mmio_map(const char *name, paddr_t addr,
 word_t map_read(paddr_t addr, int len, IOMap *map);
 void map_write(paddr_t addr, int len, word_t data, IOMap *map);
 
+#ifdef CONFIG_MULTI_HART
+// serialize the devices between the harts
+void device_lock();
+void device_unlock();
+#endif
+
 #endif
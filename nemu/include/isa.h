@@ -27,15 +27,20 @@ typedef concat(__GUEST_ISA__, _ISADecodeInfo) ISADecodeInfo;
 // monitor
 extern unsigned char isa_logo[];
 void init_isa();
+void init_isa_hart(int hartid, vaddr_t pc);
 
 // reg
-extern CPU_state cpu;
+// each hart has its own state on its own thread, see cpu-exec.c
+#define HART_LOCAL MUXDEF(CONFIG_MULTI_HART, __thread, )
+extern HART_LOCAL CPU_state cpu;
 void isa_reg_display();
 word_t isa_reg_str2val(const char *name, bool *success);
 
 // exec
 struct Decode;
 int isa_exec_once(struct Decode *s);
+// forget the decoded instructions, e.g. after the breakpoints are changed
+void isa_decode_flush();
 
 // memory
 enum { MMU_DIRECT, MMU_TRANSLATE, MMU_FAIL };
@@ -45,14 +50,28 @@ enum { MEM_RET_OK, MEM_RET_FAIL, MEM_RET_CROSS_PAGE };
 int isa_mmu_check(vaddr_t vaddr, int len, int type);
 #endif
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type);
+// the same as isa_mmu_translate() but without side effects, for the debugger
+paddr_t isa_mmu_probe(vaddr_t vaddr, int len, int type);
+// raise the page fault of a failed translation, which does not return,
+// or return if the ISA can not take it at this point
+void isa_mmu_fault(vaddr_t vaddr, int type);
+void isa_mmu_statistic();
 
 // interrupt/exception
 vaddr_t isa_raise_intr(word_t NO, vaddr_t epc);
 #define INTR_EMPTY ((word_t)-1)
 word_t isa_query_intr();
+void isa_pend_intr();
 
 // difftest
 bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc);
+bool isa_difftest_checkregs_with(CPU_state *ref_r, CPU_state *dut_r, vaddr_t pc);
+int isa_difftest_commit_reg(struct Decode *s, word_t *val);
+void isa_difftest_commit_apply(CPU_state *r, int rd, word_t val, vaddr_t npc);
 void isa_difftest_attach();
 
+// gdb, register `i` in the numbering of gdb, false if it is not supported
+bool isa_gdb_reg_read(int i, word_t *val);
+bool isa_gdb_reg_write(int i, word_t val);
+
 #endif
@@ -18,22 +18,43 @@
 
 #include <common.h>
 
+// Accesses with a fixed width. memcpy() makes an unaligned address well
+// defined and is still compiled to a single load/store. The host is
+// assumed to be little-endian, as the guest.
+#define def_host_access(len, type) \
+  static inline word_t concat(host_read_, len)(void *addr) { \
+    type data; \
+    memcpy(&data, addr, sizeof(data)); \
+    return data; \
+  } \
+  static inline void concat(host_write_, len)(void *addr, word_t data) { \
+    type d = data; \
+    memcpy(addr, &d, sizeof(d)); \
+  }
+
+def_host_access(1, uint8_t)
+def_host_access(2, uint16_t)
+def_host_access(4, uint32_t)
+#ifdef CONFIG_ISA64
+def_host_access(8, uint64_t)
+#endif
+
 static inline word_t host_read(void *addr, int len) {
   switch (len) {
-    case 1: return *(uint8_t  *)addr;
-    case 2: return *(uint16_t *)addr;
-    case 4: return *(uint32_t *)addr;
-    IFDEF(CONFIG_ISA64, case 8: return *(uint64_t *)addr);
+    case 1: return host_read_1(addr);
+    case 2: return host_read_2(addr);
+    case 4: return host_read_4(addr);
+    IFDEF(CONFIG_ISA64, case 8: return host_read_8(addr));
     default: MUXDEF(CONFIG_RT_CHECK, assert(0), return 0);
   }
 }
 
 static inline void host_write(void *addr, int len, word_t data) {
   switch (len) {
-    case 1: *(uint8_t  *)addr = data; return;
-    case 2: *(uint16_t *)addr = data; return;
-    case 4: *(uint32_t *)addr = data; return;
-    IFDEF(CONFIG_ISA64, case 8: *(uint64_t *)addr = data; return);
+    case 1: host_write_1(addr, data); return;
+    case 2: host_write_2(addr, data); return;
+    case 4: host_write_4(addr, data); return;
+    IFDEF(CONFIG_ISA64, case 8: host_write_8(addr, data); return);
     IFDEF(CONFIG_RT_CHECK, default: assert(0));
   }
 }
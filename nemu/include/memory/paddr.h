@@ -31,7 +31,44 @@ static inline bool in_pmem(paddr_t addr) {
   return addr - CONFIG_MBASE < CONFIG_MSIZE;
 }
 
+#ifdef CONFIG_MEM_REGIONS
+typedef struct {
+  const char *name;
+  paddr_t base;
+  paddr_t size;
+  bool writable;
+  const char *img; // file backing the region, empty for none
+  uint8_t *space;
+} MemRegion;
+
+MemRegion* find_mem_region(paddr_t addr);
+// the first region overlapped with [left, right], NULL if there is none
+MemRegion* find_mem_region_overlap(paddr_t left, paddr_t right);
+// call f on every enabled region
+void foreach_mem_region(void (*f)(MemRegion *r));
+#endif
+
+/* convert [paddr, paddr + len) in pmem or a memory region to host address, NULL if it is not memory */
+uint8_t* paddr_to_host(paddr_t paddr, size_t len);
+
+#ifndef CONFIG_TARGET_AM
+/* map a file to memory copy-on-write, return false if it is not possible */
+bool pmem_map_file(int fd, off_t offset, paddr_t paddr, size_t size);
+#endif
+
 word_t paddr_read(paddr_t addr, int len);
 void paddr_write(paddr_t addr, int len, word_t data);
 
+/* the same as above with a fixed width, without dispatching on len */
+word_t paddr_read_1(paddr_t addr);
+word_t paddr_read_2(paddr_t addr);
+word_t paddr_read_4(paddr_t addr);
+void paddr_write_1(paddr_t addr, word_t data);
+void paddr_write_2(paddr_t addr, word_t data);
+void paddr_write_4(paddr_t addr, word_t data);
+#ifdef CONFIG_ISA64
+word_t paddr_read_8(paddr_t addr);
+void paddr_write_8(paddr_t addr, word_t data);
+#endif
+
 #endif
@@ -18,10 +18,27 @@
 
 #include <common.h>
 
+// the physical address of an access within a page, false if the translation
+// fails, which is left to the caller
+bool vaddr_translate(vaddr_t addr, int len, int type, paddr_t *paddr);
+// the same but leaves the guest untouched, for the debugger
+bool vaddr_probe(vaddr_t addr, int len, int type, paddr_t *paddr);
+
 word_t vaddr_ifetch(vaddr_t addr, int len);
 word_t vaddr_read(vaddr_t addr, int len);
 void vaddr_write(vaddr_t addr, int len, word_t data);
 
+word_t vaddr_read_1(vaddr_t addr);
+word_t vaddr_read_2(vaddr_t addr);
+word_t vaddr_read_4(vaddr_t addr);
+void vaddr_write_1(vaddr_t addr, word_t data);
+void vaddr_write_2(vaddr_t addr, word_t data);
+void vaddr_write_4(vaddr_t addr, word_t data);
+#ifdef CONFIG_ISA64
+word_t vaddr_read_8(vaddr_t addr);
+void vaddr_write_8(vaddr_t addr, word_t data);
+#endif
+
 #define PAGE_SHIFT        12
 #define PAGE_SIZE         (1ul << PAGE_SHIFT)
 #define PAGE_MASK         (PAGE_SIZE - 1)
@@ -19,6 +19,7 @@
 #include <locale.h>
 #include "../monitor/sdb/sdb.h"
 #include <memory/paddr.h>
+#include <device/event.h>
 /* The assembly code of instructions executed is only output to the screen
  * when the number of instructions executed is less than this value.
  * This is useful when you use the `si' command.
@@ -35,6 +36,7 @@ static char iringbuf[IRINGBUF_SIZE][LOG_ENTRY_SIZE];
 static int p_head = 0;
 static bool is_full = false;
 
+#ifdef CONFIG_ITRACE
 // 将日志写入缓冲区的函数 (声明为 static)
 static void iringbuf_write(const char *log) {
   // 使用 snprintf 安全地将日志内容写入环形缓冲区
@@ -53,6 +55,7 @@ static void iringbuf_write(const char *log) {
     is_full = true;
   }
 }
+#endif
 
 
 // 打印缓冲区内容的函数 (声明为 static)
@@ -81,12 +84,11 @@ static void iringbuf_display() {
 }
 
 
-CPU_state cpu = {};
-uint64_t g_nr_guest_inst = 0;
+HART_LOCAL CPU_state cpu = {};
+uint64_t g_nr_guest_inst = 0; // of hart 0
 static uint64_t g_timer = 0; // unit: us
 static bool g_print_step = false;
 
-void device_update();
 
 static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_ITRACE_COND
@@ -96,7 +98,7 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #ifdef CONFIG_FTRACE
   char ftrace_buf[128];
   // a. 准备ftrace日志
-  uint32_t inst = paddr_read(_this->pc, 4);
+  uint32_t inst = MUXDEF(CONFIG_ISA_riscv, _this->isa.expanded, paddr_read(_this->pc, 4));
   if (ftrace_log(ftrace_buf, sizeof(ftrace_buf), _this->pc, dnpc, inst)) {
     // b. 如果生成了日志, 直接打印到控制台
     puts(ftrace_buf); 
@@ -104,7 +106,8 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
 #endif
 // --- FTRACE END ---
   if (g_print_step) { IFDEF(CONFIG_ITRACE, puts(_this->logbuf)); }
-  IFDEF(CONFIG_DIFFTEST, difftest_step(_this->pc, dnpc));
+  IFDEF(CONFIG_DIFFTEST, difftest_step(_this, dnpc));
+  IFDEF(CONFIG_DIFFTEST_CHECKPOINT, difftest_checkpoint());
   // 检查所有监视点
   if (check_watchpoints()) {
     // 如果有监视点被触发，设置状态为 NEMU_STOP
@@ -112,10 +115,11 @@ static void trace_and_difftest(Decode *_this, vaddr_t dnpc) {
   }
 }
 
-static void exec_once(Decode *s, vaddr_t pc) {
+// return the number of the instructions executed besides the one at pc
+static int exec_once(Decode *s, vaddr_t pc) {
   s->pc = pc;
   s->snpc = pc;
-  isa_exec_once(s);
+  int nr_fused = isa_exec_once(s);
   cpu.pc = s->dnpc;
 #ifdef CONFIG_ITRACE
   char *p = s->logbuf;
@@ -141,17 +145,141 @@ static void exec_once(Decode *s, vaddr_t pc) {
   disassemble(p, s->logbuf + sizeof(s->logbuf) - p,
       MUXDEF(CONFIG_ISA_x86, s->snpc, s->pc), (uint8_t *)&s->isa.inst, ilen);
 #endif
+  return nr_fused;
+}
+
+#ifdef CONFIG_MULTI_HART
+#include <pthread.h>
+
+/* Hart 0 runs on the main thread, so it is the hart seen by sdb, trace
+ * and difftest, and it runs the device events. The other harts run on
+ * their own threads while cpu_exec() is running on hart 0. In quantum mode
+ * the harts take turns, which is slower but reproducible.
+ */
+#define HART_QUANTUM CONFIG_HART_QUANTUM
+
+static pthread_mutex_t hart_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hart_cond = PTHREAD_COND_INITIALIZER;
+static uint64_t run_gen = 0;  // increased at every cpu_exec()
+static int nr_hart_running = 0;
+static bool hart_stop = false;
+static int turn = 0;          // the hart allowed to run in quantum mode
+static vaddr_t hart_entry = 0;
+static uint64_t hart_inst[CONFIG_NR_HART] = {};
+static HART_LOCAL uint64_t quantum_end = UINT64_MAX;
+
+static bool hart_running() {
+  return __atomic_load_n(&nemu_state.state, __ATOMIC_RELAXED) == NEMU_RUNNING &&
+    !__atomic_load_n(&hart_stop, __ATOMIC_RELAXED);
+}
+
+// pass the turn to the next hart and wait until it comes back
+static void hart_yield(uint64_t nr_inst) {
+  int id = cpu.mhartid;
+  pthread_mutex_lock(&hart_lock);
+  turn = (id + 1) % CONFIG_NR_HART;
+  pthread_cond_broadcast(&hart_cond);
+  while (turn != id && hart_running()) pthread_cond_wait(&hart_cond, &hart_lock);
+  pthread_mutex_unlock(&hart_lock);
+  quantum_end = nr_inst + HART_QUANTUM;
+}
+
+static void *hart_thread(void *arg) {
+  int id = (intptr_t)arg;
+  init_isa_hart(id, hart_entry);
+  uint64_t gen = 0;
+  Decode s;
+  pthread_mutex_lock(&hart_lock);
+  while (true) {
+    while (run_gen == gen) pthread_cond_wait(&hart_cond, &hart_lock);
+    gen = run_gen;
+    if (HART_QUANTUM > 0) {
+      while (turn != id && hart_running()) pthread_cond_wait(&hart_cond, &hart_lock);
+    }
+    pthread_mutex_unlock(&hart_lock);
+
+    // no trace here, the tracers are not thread-safe
+    uint64_t nr_inst = hart_inst[id];
+    quantum_end = (HART_QUANTUM > 0 ? nr_inst + HART_QUANTUM : UINT64_MAX);
+    while (hart_running()) {
+      s.pc = s.snpc = cpu.pc;
+      IFDEF(CONFIG_INST_FUSION, s.can_fuse = true);
+      nr_inst += 1 + isa_exec_once(&s);
+      cpu.pc = s.dnpc;
+      if (unlikely(nr_inst >= quantum_end)) hart_yield(nr_inst);
+    }
+
+    pthread_mutex_lock(&hart_lock);
+    hart_inst[id] = nr_inst;
+    if (turn == id) turn = (id + 1) % CONFIG_NR_HART;
+    nr_hart_running --;
+    pthread_cond_broadcast(&hart_cond);
+  }
+  return NULL;
+}
+
+static void harts_start() {
+  static bool created = false;
+  pthread_mutex_lock(&hart_lock);
+  if (!created) {
+    // the other harts start where hart 0 starts
+    hart_entry = cpu.pc;
+    for (intptr_t i = 1; i < CONFIG_NR_HART; i ++) {
+      pthread_t thread;
+      int ret = pthread_create(&thread, NULL, hart_thread, (void *)i);
+      Assert(ret == 0, "failed to create the thread of hart %d", (int)i);
+      pthread_detach(thread);
+    }
+    created = true;
+  }
+  hart_stop = false;
+  turn = 0;
+  nr_hart_running = CONFIG_NR_HART - 1;
+  run_gen ++;
+  quantum_end = (HART_QUANTUM > 0 ? g_nr_guest_inst + HART_QUANTUM : UINT64_MAX);
+  pthread_cond_broadcast(&hart_cond);
+  pthread_mutex_unlock(&hart_lock);
+}
+
+static void harts_stop() {
+  pthread_mutex_lock(&hart_lock);
+  hart_stop = true;
+  pthread_cond_broadcast(&hart_cond);
+  while (nr_hart_running > 0) pthread_cond_wait(&hart_cond, &hart_lock);
+  pthread_mutex_unlock(&hart_lock);
+  hart_inst[0] = g_nr_guest_inst;
+}
+#endif
+
+// The pending interrupts are only checked when the events are due. A device
+// raising one sets next_event to 0 so it is taken after the current instruction.
+#ifdef CONFIG_DEVICE
+static void check_intr() {
+  word_t intr = isa_query_intr();
+  if (intr != INTR_EMPTY) {
+    difftest_intr(intr);
+    cpu.pc = isa_raise_intr(intr, cpu.pc);
+  }
 }
+#endif
 
 static void execute(uint64_t n) {
   Decode s;
+  // a watchpoint must be checked after every instruction, e.g. `w $pc == X`
+  IFDEF(CONFIG_INST_FUSION, bool fuse = !has_watchpoint());
+  IFDEF(CONFIG_MULTI_HART, harts_start());
   for (;n > 0; n --) {
-    exec_once(&s, cpu.pc);
-    g_nr_guest_inst ++;
+    IFDEF(CONFIG_INST_FUSION, s.can_fuse = fuse && (n > 1));
+    int nr_fused = exec_once(&s, cpu.pc);
+    IFDEF(CONFIG_GDB_STUB, if (unlikely(nr_fused < 0)) break);
+    g_nr_guest_inst += 1 + nr_fused;
+    n -= nr_fused;
     trace_and_difftest(&s, cpu.pc);
+    IFDEF(CONFIG_MULTI_HART, if (unlikely(g_nr_guest_inst >= quantum_end)) hart_yield(g_nr_guest_inst));
     if (nemu_state.state != NEMU_RUNNING) break;
-    IFDEF(CONFIG_DEVICE, device_update());
+    IFDEF(CONFIG_DEVICE, if (unlikely(g_nr_guest_inst >= next_event)) { event_update(); check_intr(); });
   }
+  IFDEF(CONFIG_MULTI_HART, harts_stop());
 }
 
 static void statistic() {
@@ -159,11 +287,24 @@ static void statistic() {
 #define NUMBERIC_FMT MUXDEF(CONFIG_TARGET_AM, "%", "%'") PRIu64
   Log("host time spent = " NUMBERIC_FMT " us", g_timer);
   Log("total guest instructions = " NUMBERIC_FMT, g_nr_guest_inst);
+#ifdef CONFIG_MULTI_HART
+  uint64_t total = 0;
+  for (int i = 0; i < CONFIG_NR_HART; i ++) {
+    Log("  hart %d: " NUMBERIC_FMT, i, hart_inst[i]);
+    total += hart_inst[i];
+  }
+  if (g_timer > 0) Log("simulation frequency of all harts = " NUMBERIC_FMT " inst/s", total * 1000000 / g_timer);
+#endif
   if (g_timer > 0) Log("simulation frequency = " NUMBERIC_FMT " inst/s", g_nr_guest_inst * 1000000 / g_timer);
   else Log("Finish running in less than 1 us and can not calculate the simulation frequency");
+  isa_mmu_statistic();
 }
 
+void serial_flush();
+
 void assert_fail_msg() {
+  // the last output of the guest tells most about the failure
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
   isa_reg_display();
   statistic();
 }
@@ -181,6 +322,7 @@ void cpu_exec(uint64_t n) {
   uint64_t timer_start = get_time();
 
   execute(n);
+  difftest_sync();
 
   uint64_t timer_end = get_time();
   g_timer += timer_end - timer_start;
@@ -0,0 +1,115 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <cpu/difftest.h>
+
+#ifdef CONFIG_DIFFTEST_CHECKPOINT
+
+extern uint64_t g_nr_guest_inst;
+void serial_flush();
+
+// Keep two checkpoints and replay from the older one, so that the trace
+// covers at least one whole interval even if the mismatch is found right
+// after a fork.
+#define NR_CHECKPOINT 2
+
+typedef struct {
+  pid_t pid;
+  int fd;            // write end of the pipe to wake up the child
+  uint64_t nr_inst;  // g_nr_guest_inst when forking
+} Checkpoint;
+
+static Checkpoint checkpoints[NR_CHECKPOINT] = {};
+static int nr_checkpoint = 0;
+static uint64_t next_checkpoint = CONFIG_DIFFTEST_CHECKPOINT_INTERVAL;
+static bool is_replay = false;
+
+static void checkpoint_release(Checkpoint *c) {
+  close(c->fd); // the child exits once the pipe is closed
+  waitpid(c->pid, NULL, 0);
+}
+
+// the child stays frozen here until the parent finds a mismatch or exits
+static void checkpoint_wait(int fd) {
+  uint64_t target;
+  if (read(fd, &target, sizeof(target)) != sizeof(target)) _exit(0);
+  close(fd);
+
+  is_replay = true;
+  log_force_enable();
+  difftest_detach();
+  Log("checkpoint: replay instructions (%" PRIu64 ", %" PRIu64 "] with full tracing",
+      g_nr_guest_inst, target);
+  cpu_exec(target - g_nr_guest_inst);
+  isa_reg_display();
+  Log("checkpoint: replay stops at pc = " FMT_WORD, cpu.pc);
+  fflush(NULL);
+  _exit(0);
+}
+
+void difftest_checkpoint() {
+  if (likely(g_nr_guest_inst < next_checkpoint) || is_replay) return;
+  if (nemu_state.state != NEMU_RUNNING) return;
+  next_checkpoint = g_nr_guest_inst + CONFIG_DIFFTEST_CHECKPOINT_INTERVAL;
+
+  int pipefd[2];
+  Assert(pipe(pipefd) == 0, "can not create pipe for checkpoint");
+  // otherwise the buffered output is duplicated in the child
+  fflush(NULL);
+  IFDEF(CONFIG_HAS_SERIAL, serial_flush());
+  pid_t pid = fork();
+  Assert(pid >= 0, "can not fork checkpoint");
+  if (pid == 0) {
+    close(pipefd[1]);
+    for (int i = 0; i < nr_checkpoint; i ++) close(checkpoints[i].fd);
+    checkpoint_wait(pipefd[0]);
+  }
+  close(pipefd[0]);
+
+  if (nr_checkpoint == NR_CHECKPOINT) {
+    checkpoint_release(&checkpoints[0]);
+    memmove(&checkpoints[0], &checkpoints[1], sizeof(checkpoints[0]) * (NR_CHECKPOINT - 1));
+    nr_checkpoint --;
+  }
+  checkpoints[nr_checkpoint ++] = (Checkpoint) { .pid = pid, .fd = pipefd[1], .nr_inst = g_nr_guest_inst };
+}
+
+// called by DUT when a mismatch is found at the current instruction
+void difftest_checkpoint_replay() {
+  if (is_replay) return;
+  if (nr_checkpoint == 0) {
+    Log("checkpoint: no checkpoint before the mismatch, "
+        "try a smaller CONFIG_DIFFTEST_CHECKPOINT_INTERVAL");
+    return;
+  }
+
+  Checkpoint *c = &checkpoints[0];
+  uint64_t target = g_nr_guest_inst;
+  Log("checkpoint: replay from the checkpoint at instruction %" PRIu64, c->nr_inst);
+  fflush(NULL);
+  if (write(c->fd, &target, sizeof(target)) != sizeof(target)) {
+    Log("checkpoint: can not wake up the checkpoint process %d", c->pid);
+  }
+
+  for (int i = 0; i < nr_checkpoint; i ++) checkpoint_release(&checkpoints[i]);
+  nr_checkpoint = 0;
+}
+#endif
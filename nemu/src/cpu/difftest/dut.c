@@ -14,9 +14,14 @@
 ***************************************************************************************/
 
 #include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 #include <isa.h>
 #include <cpu/cpu.h>
+#include <cpu/decode.h>
+#include <cpu/difftest.h>
 #include <memory/paddr.h>
 #include <utils.h>
 #include <difftest-def.h>
@@ -25,15 +30,184 @@ void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) =
 void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
 void (*ref_difftest_exec)(uint64_t n) = NULL;
 void (*ref_difftest_raise_intr)(uint64_t NO) = NULL;
+void (*ref_difftest_exec_block)(uint64_t last_pc, uint64_t n) = NULL;
 
 #ifdef CONFIG_DIFFTEST
 
 static bool is_skip_ref = false;
 static int skip_dut_nr_inst = 0;
+static bool is_detach = false;
+
+static void checkregs(CPU_state *ref, vaddr_t pc) {
+  if (!isa_difftest_checkregs(ref, pc)) {
+    nemu_state.state = NEMU_ABORT;
+    nemu_state.halt_pc = pc;
+    isa_reg_display();
+    IFDEF(CONFIG_DIFFTEST_CHECKPOINT, difftest_checkpoint_replay());
+  }
+}
+
+#ifdef CONFIG_DIFFTEST_BLOCK
+// Instructions executed by DUT but not yet by REF. They always form a
+// straight-line sequence ending at `block_last_pc`, so REF reaches
+// `block_last_pc` exactly once when catching up.
+static uint64_t block_nr_inst = 0;
+static vaddr_t block_last_pc = 0;
+
+static void difftest_exec_block() {
+  if (block_nr_inst == 0) return;
+  if (ref_difftest_exec_block) ref_difftest_exec_block(block_last_pc, block_nr_inst);
+  else ref_difftest_exec(block_nr_inst);
+  block_nr_inst = 0;
+}
+
+// Let REF catch up with the pending block before the current instruction,
+// which has not committed yet, so the state of DUT is still the one before it.
+static void difftest_catch_up() {
+  if (block_nr_inst > 0) {
+    CPU_state ref_r;
+    difftest_exec_block();
+    ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+    checkregs(&ref_r, block_last_pc);
+  }
+}
+#endif
+
+#ifdef CONFIG_DIFFTEST_ASYNC
+#define COMMIT_QUEUE_SIZE CONFIG_DIFFTEST_ASYNC_QUEUE_SIZE
+static_assert((COMMIT_QUEUE_SIZE & (COMMIT_QUEUE_SIZE - 1)) == 0,
+    "CONFIG_DIFFTEST_ASYNC_QUEUE_SIZE must be a power of 2");
+
+// an instruction committed by DUT, checked later by the checker thread
+typedef struct {
+  vaddr_t pc, npc;
+  int rd;          // the written GPR, -1 if none
+  word_t rd_val;
+  paddr_t st_addr; // the store to pmem, valid if st_len > 0
+  int st_len;
+  word_t st_data;
+  bool skip;       // not executed by REF, just copy the state to REF
+} Commit;
+
+// single producer (DUT) and single consumer (checker thread)
+static Commit commit_queue[COMMIT_QUEUE_SIZE];
+static uint64_t commit_head = 0; // only written by the checker thread
+static uint64_t commit_tail = 0; // only written by DUT
+static bool commit_error = false;
+static uint64_t commit_error_idx = 0;
+
+static int st_len = 0;
+static paddr_t st_addr = 0;
+static word_t st_data = 0;
+
+// the state of DUT after the last checked commit
+static CPU_state shadow = {};
+
+static void spin_wait(int *nr_spin) {
+  if (*nr_spin < 1024) (*nr_spin) ++;
+  else if (*nr_spin < 2048) { (*nr_spin) ++; sched_yield(); }
+  else usleep(100); // DUT is probably waiting in sdb
+}
+
+static bool check_commit(Commit *c) {
+  isa_difftest_commit_apply(&shadow, c->rd, c->rd_val, c->npc);
+  if (c->skip) {
+    ref_difftest_regcpy(&shadow, DIFFTEST_TO_REF);
+    return true;
+  }
+
+  CPU_state ref_r;
+  ref_difftest_exec(1);
+  ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
+  if (!isa_difftest_checkregs_with(&ref_r, &shadow, c->pc)) return false;
+
+  if (c->st_len > 0) {
+    word_t ref_data = 0;
+    word_t mask = (c->st_len == sizeof(word_t) ? -1 : ((word_t)1 << (c->st_len * 8)) - 1);
+    ref_difftest_memcpy(c->st_addr, &ref_data, c->st_len, DIFFTEST_TO_DUT);
+    if (ref_data != (c->st_data & mask)) {
+      Log("difftest: memory[" FMT_PADDR "] is different after executing instruction at pc = " FMT_WORD
+          ", right = " FMT_WORD ", wrong = " FMT_WORD,
+          c->st_addr, c->pc, ref_data, c->st_data & mask);
+      return false;
+    }
+  }
+  return true;
+}
+
+static void *checker_thread(void *arg) {
+  int nr_spin = 0;
+  while (true) {
+    uint64_t head = commit_head;
+    if (head == __atomic_load_n(&commit_tail, __ATOMIC_ACQUIRE)) {
+      spin_wait(&nr_spin);
+      continue;
+    }
+    nr_spin = 0;
+    if (!check_commit(&commit_queue[head % COMMIT_QUEUE_SIZE])) {
+      commit_error_idx = head;
+      __atomic_store_n(&commit_error, true, __ATOMIC_RELEASE);
+      return NULL;
+    }
+    __atomic_store_n(&commit_head, head + 1, __ATOMIC_RELEASE);
+  }
+}
+
+static void commit_check_error() {
+  if (!__atomic_load_n(&commit_error, __ATOMIC_ACQUIRE)) return;
+  Commit *c = &commit_queue[commit_error_idx % COMMIT_QUEUE_SIZE];
+  Log("difftest: DUT had run %" PRIu64 " more instructions when the error was found",
+      commit_tail - commit_error_idx - 1);
+  nemu_state.state = NEMU_ABORT;
+  nemu_state.halt_pc = c->pc;
+}
+
+static void commit_push(Commit *c) {
+  int nr_spin = 0;
+  // back-pressure: DUT can not run too far ahead of REF
+  while (commit_tail - __atomic_load_n(&commit_head, __ATOMIC_ACQUIRE) == COMMIT_QUEUE_SIZE) {
+    if (__atomic_load_n(&commit_error, __ATOMIC_ACQUIRE)) return;
+    spin_wait(&nr_spin);
+  }
+  commit_queue[commit_tail % COMMIT_QUEUE_SIZE] = *c;
+  __atomic_store_n(&commit_tail, commit_tail + 1, __ATOMIC_RELEASE);
+}
+
+void difftest_commit_store(paddr_t addr, int len, word_t data) {
+  st_addr = addr;
+  st_len = len;
+  st_data = data;
+}
+
+// wait for the checker thread to consume all commits
+void difftest_sync() {
+  int nr_spin = 0;
+  while (__atomic_load_n(&commit_head, __ATOMIC_ACQUIRE) != commit_tail) {
+    if (__atomic_load_n(&commit_error, __ATOMIC_ACQUIRE)) break;
+    spin_wait(&nr_spin);
+  }
+  commit_check_error();
+}
+
+static void init_checker() {
+  shadow = cpu;
+  pthread_t thread;
+  int ret = pthread_create(&thread, NULL, checker_thread, NULL);
+  Assert(ret == 0, "can not create the difftest checker thread");
+  pthread_detach(thread);
+  Log("Differential testing runs REF on a separate thread with a %d-entry commit queue",
+      COMMIT_QUEUE_SIZE);
+}
+#else
+void difftest_sync() { }
+#endif
 
 // this is used to let ref skip instructions which
 // can not produce consistent behavior with NEMU
 void difftest_skip_ref() {
+  if (is_detach) return;
+  // the instruction accessing MMIO is not executed by REF
+  IFDEF(CONFIG_DIFFTEST_BLOCK, difftest_catch_up());
   is_skip_ref = true;
   // If such an instruction is one of the instruction packing in QEMU
   // (see below), we end the process of catching up with QEMU's pc to
@@ -52,6 +226,7 @@ void difftest_skip_ref() {
 //   Let REF run `nr_ref` instructions first.
 //   We expect that DUT will catch up with REF within `nr_dut` instructions.
 void difftest_skip_dut(int nr_ref, int nr_dut) {
+  IFDEF(CONFIG_DIFFTEST_ASYNC, panic("skipping DUT is not supported by CONFIG_DIFFTEST_ASYNC"));
   skip_dut_nr_inst += nr_dut;
 
   while (nr_ref -- > 0) {
@@ -78,6 +253,9 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_raise_intr = dlsym(handle, "difftest_raise_intr");
   assert(ref_difftest_raise_intr);
 
+  // optional, REF without it catches up by difftest_exec()
+  ref_difftest_exec_block = dlsym(handle, "difftest_exec_block");
+
   void (*ref_difftest_init)(int) = dlsym(handle, "difftest_init");
   assert(ref_difftest_init);
 
@@ -89,19 +267,71 @@ void init_difftest(char *ref_so_file, long img_size, int port) {
   ref_difftest_init(port);
   ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
   ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  IFDEF(CONFIG_DIFFTEST_ASYNC, init_checker());
 }
 
-static void checkregs(CPU_state *ref, vaddr_t pc) {
-  if (!isa_difftest_checkregs(ref, pc)) {
-    nemu_state.state = NEMU_ABORT;
-    nemu_state.halt_pc = pc;
-    isa_reg_display();
-  }
+void difftest_detach() {
+  difftest_sync();
+  is_detach = true;
+}
+
+#ifdef CONFIG_MEM_REGIONS
+static void region_to_ref(MemRegion *r) {
+  ref_difftest_memcpy(r->base, r->space, r->size, DIFFTEST_TO_REF);
+}
+#endif
+
+// REF may be far behind, so copy the whole state of DUT to it
+void difftest_attach() {
+  difftest_sync();
+  is_detach = false;
+  is_skip_ref = false;
+  skip_dut_nr_inst = 0;
+  IFDEF(CONFIG_DIFFTEST_BLOCK, block_nr_inst = 0);
+  isa_difftest_attach();
+  ref_difftest_memcpy(CONFIG_MBASE, guest_to_host(CONFIG_MBASE), CONFIG_MSIZE, DIFFTEST_TO_REF);
+  IFDEF(CONFIG_MEM_REGIONS, foreach_mem_region(region_to_ref));
+  ref_difftest_regcpy(&cpu, DIFFTEST_TO_REF);
+  IFDEF(CONFIG_DIFFTEST_ASYNC, shadow = cpu; st_len = 0);
 }
 
-void difftest_step(vaddr_t pc, vaddr_t npc) {
+// A device wrote the memory of DUT in the middle of the current
+// instruction. REF must have executed exactly the instructions before it
+// when the memory is copied.
+void difftest_dma(paddr_t addr, size_t n) {
+  if (is_detach) return;
+  difftest_sync();
+  IFDEF(CONFIG_DIFFTEST_BLOCK, difftest_catch_up());
+  ref_difftest_memcpy(addr, paddr_to_host(addr, n), n, DIFFTEST_TO_REF);
+}
+
+// Called between two instructions before DUT takes the interrupt, so REF
+// is checked against the state before the trap and then takes it too.
+void difftest_intr(word_t NO) {
+  if (is_detach) return;
+  difftest_sync();
+  IFDEF(CONFIG_DIFFTEST_BLOCK, difftest_catch_up());
+  ref_difftest_raise_intr(NO);
+  IFDEF(CONFIG_DIFFTEST_ASYNC, ref_difftest_regcpy(&shadow, DIFFTEST_TO_DUT));
+}
+
+void difftest_step(Decode *s, vaddr_t npc) {
+  vaddr_t pc = s->pc;
   CPU_state ref_r;
 
+  if (is_detach) return;
+
+#ifdef CONFIG_DIFFTEST_ASYNC
+  Commit c = { .pc = pc, .npc = npc, .skip = is_skip_ref,
+    .st_addr = st_addr, .st_len = st_len, .st_data = st_data };
+  c.rd = isa_difftest_commit_reg(s, &c.rd_val);
+  commit_push(&c);
+  is_skip_ref = false;
+  st_len = 0;
+  commit_check_error();
+  return;
+#endif
+
   if (skip_dut_nr_inst > 0) {
     ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
     if (ref_r.pc == npc) {
@@ -122,7 +352,15 @@ void difftest_step(vaddr_t pc, vaddr_t npc) {
     return;
   }
 
+#ifdef CONFIG_DIFFTEST_BLOCK
+  block_nr_inst ++;
+  block_last_pc = pc;
+  // only compare at the end of a basic block
+  if (npc == s->snpc) return;
+  difftest_exec_block();
+#else
   ref_difftest_exec(1);
+#endif
   ref_difftest_regcpy(&ref_r, DIFFTEST_TO_DUT);
 
   checkregs(&ref_r, pc);
@@ -19,19 +19,23 @@
 #include <memory/paddr.h>
 
 __EXPORT void difftest_memcpy(paddr_t addr, void *buf, size_t n, bool direction) {
-  assert(0);
+  uint8_t *haddr = paddr_to_host(addr, n);
+  Assert(haddr != NULL, "[" FMT_PADDR ", " FMT_PADDR ") is not memory", addr, (paddr_t)(addr + n));
+  if (direction == DIFFTEST_TO_REF) memcpy(haddr, buf, n);
+  else memcpy(buf, haddr, n);
 }
 
 __EXPORT void difftest_regcpy(void *dut, bool direction) {
-  assert(0);
+  if (direction == DIFFTEST_TO_REF) memcpy(&cpu, dut, DIFFTEST_REG_SIZE);
+  else memcpy(dut, &cpu, DIFFTEST_REG_SIZE);
 }
 
 __EXPORT void difftest_exec(uint64_t n) {
-  assert(0);
+  cpu_exec(n);
 }
 
 __EXPORT void difftest_raise_intr(word_t NO) {
-  assert(0);
+  cpu.pc = isa_raise_intr(NO, cpu.pc);
 }
 
 __EXPORT void difftest_init(int port) {
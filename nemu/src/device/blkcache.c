@@ -0,0 +1,260 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "blkcache.h"
+
+#define NR_CACHE   1024 // 512KB
+#define NR_BUCKET  1024
+#define NR_REQ     64
+#define RUN_MAX    64   // blocks in a single pread()/pwrite()
+
+enum { BLK_FREE, BLK_LOADING, BLK_VALID };
+
+typedef struct CacheBlk {
+  uint64_t blkno;
+  int state;
+  bool dirty;
+  struct CacheBlk *prev, *next; // LRU list, the most recently used first
+  struct CacheBlk *hnext;
+  uint8_t data[BLK_SIZE];
+} CacheBlk;
+
+// a read-ahead request
+typedef struct {
+  uint64_t blkno;
+  uint32_t n;
+} IOReq;
+
+static int fd = -1;
+static CacheBlk cache[NR_CACHE];
+static CacheBlk *bucket[NR_BUCKET];
+static CacheBlk lru;
+static IOReq req[NR_REQ];
+static int req_head = 0, req_tail = 0;
+// a forked child, e.g. a difftest checkpoint, has no I/O thread
+static bool no_io_thread = false;
+
+// Everything above is protected by `lock`. A block in BLK_LOADING is owned
+// by whoever is loading it and never evicted.
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+
+static void lru_unlink(CacheBlk *b) {
+  b->prev->next = b->next;
+  b->next->prev = b->prev;
+}
+
+static void lru_touch(CacheBlk *b) {
+  lru_unlink(b);
+  b->next = lru.next;
+  b->prev = &lru;
+  lru.next->prev = b;
+  lru.next = b;
+}
+
+static CacheBlk* lookup(uint64_t blkno) {
+  for (CacheBlk *b = bucket[blkno % NR_BUCKET]; b != NULL; b = b->hnext) {
+    if (b->blkno == blkno) return b;
+  }
+  return NULL;
+}
+
+static void hash_remove(CacheBlk *b) {
+  CacheBlk **p = &bucket[b->blkno % NR_BUCKET];
+  while (*p != b) p = &(*p)->hnext;
+  *p = b->hnext;
+}
+
+static void read_blk(uint64_t blkno, uint8_t *buf, uint32_t n) {
+  ssize_t ret = pread(fd, buf, n * BLK_SIZE, blkno * BLK_SIZE);
+  if (ret < 0) ret = 0;
+  // beyond the end of the image
+  memset(buf + ret, 0, n * BLK_SIZE - ret);
+}
+
+static void write_blk(uint64_t blkno, uint8_t *buf, uint32_t n) {
+  ssize_t ret = pwrite(fd, buf, n * BLK_SIZE, blkno * BLK_SIZE);
+  if (ret != n * BLK_SIZE) Log("sdcard: can not write block %" PRIu64, blkno);
+}
+
+// take the least recently used block which is not being loaded
+static CacheBlk* alloc_blk(uint64_t blkno) {
+  CacheBlk *b = lru.prev;
+  while (b->state == BLK_LOADING) b = b->prev;
+  assert(b != &lru);
+  if (b->state != BLK_FREE) {
+    // rare, write-back normally happens at the end of a command
+    if (b->dirty) write_blk(b->blkno, b->data, 1);
+    hash_remove(b);
+  }
+  b->blkno = blkno;
+  b->state = BLK_LOADING;
+  b->dirty = false;
+  b->hnext = bucket[blkno % NR_BUCKET];
+  bucket[blkno % NR_BUCKET] = b;
+  lru_touch(b);
+  return b;
+}
+
+static void push_req(IOReq r) {
+  while (req_tail - req_head == NR_REQ) pthread_cond_wait(&cond, &lock);
+  req[req_tail % NR_REQ] = r;
+  req_tail ++;
+  pthread_cond_broadcast(&cond);
+}
+
+uint8_t* blkcache_get(uint64_t blkno, bool is_write) {
+  pthread_mutex_lock(&lock);
+  CacheBlk *b = lookup(blkno);
+  if (b == NULL) {
+    b = alloc_blk(blkno);
+    if (!is_write) {
+      pthread_mutex_unlock(&lock);
+      read_blk(blkno, b->data, 1);
+      pthread_mutex_lock(&lock);
+    }
+    b->state = BLK_VALID;
+  }
+  // being loaded by read-ahead
+  while (b->state == BLK_LOADING) pthread_cond_wait(&cond, &lock);
+  lru_touch(b);
+  pthread_mutex_unlock(&lock);
+  return b->data;
+}
+
+void blkcache_dirty(uint64_t blkno) {
+  pthread_mutex_lock(&lock);
+  CacheBlk *b = lookup(blkno);
+  if (b != NULL) b->dirty = true;
+  pthread_mutex_unlock(&lock);
+}
+
+void blkcache_readahead(uint64_t blkno, uint32_t n) {
+  if (no_io_thread) return;
+  if (n > NR_CACHE / 2) n = NR_CACHE / 2;
+  pthread_mutex_lock(&lock);
+  for (uint32_t i = 0; i < n; i ++) {
+    if (lookup(blkno + i) == NULL) alloc_blk(blkno + i);
+  }
+  push_req((IOReq){ .blkno = blkno, .n = n });
+  pthread_mutex_unlock(&lock);
+}
+
+// Called with `lock` held. Load the consecutive blocks in BLK_LOADING
+// with a single pread().
+static void do_readahead(IOReq *r) {
+  static uint8_t buf[RUN_MAX * BLK_SIZE];
+  CacheBlk *run[RUN_MAX];
+  for (uint64_t i = 0; i < r->n; ) {
+    int n = 0;
+    CacheBlk *b;
+    while (i < r->n && n < RUN_MAX && (b = lookup(r->blkno + i)) != NULL && b->state == BLK_LOADING) {
+      run[n ++] = b;
+      i ++;
+    }
+    if (n == 0) { i ++; continue; }
+    uint64_t start = run[0]->blkno;
+    pthread_mutex_unlock(&lock);
+    read_blk(start, buf, n);
+    for (int k = 0; k < n; k ++) memcpy(run[k]->data, buf + k * BLK_SIZE, BLK_SIZE);
+    pthread_mutex_lock(&lock);
+    for (int k = 0; k < n; k ++) run[k]->state = BLK_VALID;
+    pthread_cond_broadcast(&cond);
+  }
+}
+
+// Write the consecutive dirty blocks with a single pwrite(). It is done
+// synchronously, so that the image is up to date even if NEMU aborts.
+void blkcache_writeback(uint64_t blkno, uint32_t n) {
+  static uint8_t buf[RUN_MAX * BLK_SIZE];
+  pthread_mutex_lock(&lock);
+  for (uint64_t i = 0; i < n; ) {
+    int k = 0;
+    uint64_t start = blkno + i;
+    CacheBlk *b;
+    while (i < n && k < RUN_MAX && (b = lookup(blkno + i)) != NULL &&
+        b->state == BLK_VALID && b->dirty) {
+      memcpy(buf + k * BLK_SIZE, b->data, BLK_SIZE);
+      b->dirty = false;
+      k ++;
+      i ++;
+    }
+    if (k == 0) { i ++; continue; }
+    write_blk(start, buf, k);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+static void *io_thread(void *arg) {
+  pthread_mutex_lock(&lock);
+  while (true) {
+    while (req_head == req_tail) pthread_cond_wait(&cond, &lock);
+    IOReq r = req[req_head % NR_REQ];
+    req_head ++;
+    pthread_cond_broadcast(&cond);
+    do_readahead(&r);
+  }
+  return NULL;
+}
+
+// Hold `lock` across fork(), so that the child gets a consistent cache.
+// The I/O thread is not in the child: the blocks it is loading or going to
+// load are loaded here, and there is no more read-ahead.
+static void fork_prepare() { pthread_mutex_lock(&lock); }
+static void fork_parent() { pthread_mutex_unlock(&lock); }
+static void fork_child() {
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&cond, NULL);
+  no_io_thread = true;
+  req_head = req_tail;
+  for (int i = 0; i < NR_CACHE; i ++) {
+    CacheBlk *b = &cache[i];
+    if (b->state == BLK_LOADING) {
+      read_blk(b->blkno, b->data, 1);
+      b->state = BLK_VALID;
+    }
+  }
+}
+
+static void blkcache_flush() {
+  pthread_mutex_lock(&lock);
+  for (int i = 0; i < NR_CACHE; i ++) {
+    CacheBlk *b = &cache[i];
+    if (b->state == BLK_VALID && b->dirty) {
+      write_blk(b->blkno, b->data, 1);
+      b->dirty = false;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void blkcache_init(int _fd) {
+  fd = _fd;
+  lru.next = lru.prev = &lru;
+  for (int i = 0; i < NR_CACHE; i ++) {
+    cache[i].next = cache[i].prev = &cache[i];
+    cache[i].state = BLK_FREE;
+    lru_touch(&cache[i]);
+  }
+  pthread_t t;
+  int ret = pthread_create(&t, NULL, io_thread, NULL);
+  Assert(ret == 0, "Can not create the sdcard I/O thread");
+  pthread_detach(t);
+  pthread_atfork(fork_prepare, fork_parent, fork_child);
+  atexit(blkcache_flush);
+}
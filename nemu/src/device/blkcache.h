@@ -0,0 +1,38 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#ifndef __BLKCACHE_H__
+#define __BLKCACHE_H__
+
+#include <common.h>
+
+#define BLK_SIZE 512
+
+// A write-back LRU cache of the blocks of an image, with an I/O thread
+// doing read-ahead. The blocks written by a command are written back at
+// its end, so nothing is lost if NEMU aborts later.
+
+void blkcache_init(int fd);
+// Return the data of block `blkno`, which is valid until the next call.
+// For a write, the block is not read from the image since the whole block
+// is always written, and blkcache_dirty() must be called once it is done.
+uint8_t* blkcache_get(uint64_t blkno, bool is_write);
+void blkcache_dirty(uint64_t blkno);
+// load [blkno, blkno + n) in the background
+void blkcache_readahead(uint64_t blkno, uint32_t n);
+// write the dirty blocks in [blkno, blkno + n) back now
+void blkcache_writeback(uint64_t blkno, uint32_t n);
+
+#endif
@@ -16,10 +16,17 @@
 #include <common.h>
 #include <utils.h>
 #include <device/alarm.h>
+#include <device/event.h>
 #ifndef CONFIG_TARGET_AM
 #include <SDL2/SDL.h>
 #endif
 
+// SDL is only pumped when there is a window to receive events
+#if defined(CONFIG_VGA_SHOW_SCREEN) && !defined(CONFIG_TARGET_AM)
+#define HAS_UI_THREAD
+#include <pthread.h>
+#endif
+
 void init_map();
 void init_serial();
 void init_timer();
@@ -28,54 +35,69 @@ void init_i8042();
 void init_audio();
 void init_disk();
 void init_sdcard();
-void init_alarm();
+void init_event();
 
-void send_key(uint8_t, bool);
+void send_key(uint8_t, bool, bool);
+void key_clear();
 void vga_update_screen();
+void vga_ui_init();
+void vga_ui_update();
 
-void device_update() {
-  static uint64_t last = 0;
-  uint64_t now = get_time();
-  if (now - last < 1000000 / TIMER_HZ) {
-    return;
-  }
-  last = now;
-
-  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+#ifdef HAS_UI_THREAD
+static bool ui_quit = false;
 
-#ifndef CONFIG_TARGET_AM
-  SDL_Event event;
-  while (SDL_PollEvent(&event)) {
-    switch (event.type) {
-      case SDL_QUIT:
-        nemu_state.state = NEMU_QUIT;
-        break;
+static void handle_event(SDL_Event *event) {
+  switch (event->type) {
+    case SDL_QUIT:
+      __atomic_store_n(&ui_quit, true, __ATOMIC_RELEASE);
+      break;
 #ifdef CONFIG_HAS_KEYBOARD
-      // If a key was pressed
-      case SDL_KEYDOWN:
-      case SDL_KEYUP: {
-        uint8_t k = event.key.keysym.scancode;
-        bool is_keydown = (event.key.type == SDL_KEYDOWN);
-        send_key(k, is_keydown);
-        break;
-      }
+    // If a key was pressed
+    case SDL_KEYDOWN:
+    case SDL_KEYUP: {
+      uint8_t k = event->key.keysym.scancode;
+      bool is_keydown = (event->key.type == SDL_KEYDOWN);
+      send_key(k, is_keydown, event->key.repeat);
+      break;
+    }
 #endif
-      default: break;
+    default: break;
+  }
+}
+
+// Own the window and pump its events, so that the CPU thread never
+// calls SDL and a slow guest does not delay the input.
+static void *ui_thread(void *arg) {
+  vga_ui_init();
+  while (true) {
+    SDL_Event event;
+    // wake up at least once per frame to redraw
+    if (SDL_WaitEventTimeout(&event, 1000 / TIMER_HZ)) {
+      do { handle_event(&event); } while (SDL_PollEvent(&event));
     }
+    vga_ui_update();
   }
+  return NULL;
+}
+#endif
+
+// scheduled TIMER_HZ times per second of host time
+static void device_update() {
+  IFDEF(CONFIG_HAS_VGA, vga_update_screen());
+#ifdef HAS_UI_THREAD
+  if (__atomic_load_n(&ui_quit, __ATOMIC_ACQUIRE)) nemu_state.state = NEMU_QUIT;
 #endif
 }
 
+// drop the keys pressed while the guest is stopped
 void sdl_clear_event_queue() {
-#ifndef CONFIG_TARGET_AM
-  SDL_Event event;
-  while (SDL_PollEvent(&event));
-#endif
+  IFDEF(CONFIG_HAS_KEYBOARD, key_clear());
 }
 
 void init_device() {
   IFDEF(CONFIG_TARGET_AM, ioe_init());
   init_map();
+  init_event();
 
   IFDEF(CONFIG_HAS_SERIAL, init_serial());
   IFDEF(CONFIG_HAS_TIMER, init_timer());
@@ -85,5 +107,12 @@ void init_device() {
   IFDEF(CONFIG_HAS_DISK, init_disk());
   IFDEF(CONFIG_HAS_SDCARD, init_sdcard());
 
-  IFNDEF(CONFIG_TARGET_AM, init_alarm());
+  add_host_event(0, 1000000 / TIMER_HZ, device_update);
+
+#ifdef HAS_UI_THREAD
+  pthread_t thread;
+  int ret = pthread_create(&thread, NULL, ui_thread, NULL);
+  Assert(ret == 0, "failed to create the UI thread");
+  pthread_detach(thread);
+#endif
 }
@@ -14,6 +14,97 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <memory/paddr.h>
+#include <cpu/difftest.h>
+#ifndef CONFIG_TARGET_AM
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// The driver writes the block number, the number of blocks and the
+// physical address of the buffer, and then a command. The whole transfer
+// is done by the time the write to reg_cmd returns.
+enum {
+  reg_blksz,
+  reg_blkcnt,
+  reg_buf,
+  reg_blkno,
+  reg_nblk,
+  reg_cmd,
+  reg_status,
+  nr_reg
+};
+
+enum { DISK_CMD_READ = 1, DISK_CMD_WRITE = 2 };
+enum { DISK_OK = 0, DISK_ERROR = 1 };
+
+#define BLKSZ 512
+
+static uint32_t *disk_base = NULL;
+static uint8_t *img = NULL;
+static uint32_t nr_blk = 0;
+
+static int disk_transfer(bool is_write) {
+  uint32_t blkno = disk_base[reg_blkno], n = disk_base[reg_nblk];
+  paddr_t buf = disk_base[reg_buf];
+  size_t size = (size_t)n * BLKSZ;
+  if (img == NULL || blkno > nr_blk || n > nr_blk - blkno) return DISK_ERROR;
+  uint8_t *haddr = paddr_to_host(buf, size);
+  if (haddr == NULL) return DISK_ERROR;
+
+  uint8_t *blk = img + (size_t)blkno * BLKSZ;
+  if (is_write) memcpy(blk, haddr, size);
+  else {
+    memcpy(haddr, blk, size);
+    difftest_dma(buf, size);
+  }
+  return DISK_OK;
+}
+
+static void disk_io_handler(uint32_t offset, int len, bool is_write) {
+  if (!is_write || offset != reg_cmd * sizeof(uint32_t)) return;
+  switch (disk_base[reg_cmd]) {
+    case DISK_CMD_READ:  disk_base[reg_status] = disk_transfer(false); break;
+    case DISK_CMD_WRITE: disk_base[reg_status] = disk_transfer(true); break;
+    default: disk_base[reg_status] = DISK_ERROR; break;
+  }
+}
+
+#ifndef CONFIG_TARGET_AM
+// map the image, so that a transfer is a single memcpy() and writes go
+// back to the file
+static void init_disk_img(const char *path) {
+  bool writable = true;
+  int fd = open(path, O_RDWR);
+  if (fd < 0) { writable = false; fd = open(path, O_RDONLY); }
+  if (fd < 0) { Log("Can not find disk image: %s", path); return; }
+
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  if (st.st_size >= BLKSZ) {
+    img = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    Assert(img != MAP_FAILED, "Can not mmap disk image: %s", path);
+    nr_blk = st.st_size / BLKSZ;
+  }
+  close(fd);
+  Log("Disk image %s, %u blocks%s", path, nr_blk, writable ? "" : " (writes are not saved)");
+}
+#endif
 
 void init_disk() {
+  uint32_t space_size = sizeof(uint32_t) * nr_reg;
+  disk_base = (uint32_t *)new_space(space_size);
+#ifdef CONFIG_HAS_PORT_IO
+  add_pio_map ("disk", CONFIG_DISK_CTL_PORT, disk_base, space_size, disk_io_handler);
+#else
+  add_mmio_map("disk", CONFIG_DISK_CTL_MMIO, disk_base, space_size, disk_io_handler);
+#endif
+
+  const char *path = CONFIG_DISK_IMG_PATH;
+  IFNDEF(CONFIG_TARGET_AM, if (path[0] != '\0') init_disk_img(path));
+  disk_base[reg_blksz] = BLKSZ;
+  disk_base[reg_blkcnt] = nr_blk;
 }
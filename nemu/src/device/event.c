@@ -0,0 +1,220 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <common.h>
+#include <utils.h>
+#include <device/event.h>
+#include <device/map.h>
+#ifndef CONFIG_TARGET_AM
+#include <unistd.h>
+#endif
+
+#define NR_EVENT 16
+// bounds of the number of instructions between two reads of the host time
+#define HOST_POLL_MIN 256
+#define HOST_POLL_MAX (1 << 22)
+
+typedef struct {
+  uint64_t when;
+  uint64_t period;
+  event_handler_t handler;
+} Event;
+
+// min-heap on `when`
+typedef struct {
+  Event e[NR_EVENT];
+  int n;
+} EventQueue;
+
+extern uint64_t g_nr_guest_inst;
+uint64_t next_event = 0;
+
+#ifdef CONFIG_TIMER_VIRTUAL
+// guest instructions skipped by event_skip_idle(), which only count for time
+static uint64_t skipped_inst = 0;
+
+static uint64_t us_to_inst(uint64_t us) {
+  uint64_t n = us * 1000 / CONFIG_TIMER_VIRTUAL_NS_PER_INST;
+  return (us > 0 && n == 0 ? 1 : n);
+}
+#endif
+
+static EventQueue inst_queue = {}, host_queue = {};
+
+static void eq_push(EventQueue *q, Event e) {
+  Assert(q->n < NR_EVENT, "too many events");
+  int i = q->n ++;
+  while (i > 0 && q->e[(i - 1) / 2].when > e.when) {
+    q->e[i] = q->e[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  q->e[i] = e;
+}
+
+static Event eq_pop(EventQueue *q) {
+  Event top = q->e[0];
+  Event last = q->e[-- q->n];
+  int i = 0;
+  while (true) {
+    int c = 2 * i + 1;
+    if (c >= q->n) break;
+    if (c + 1 < q->n && q->e[c + 1].when < q->e[c].when) c ++;
+    if (last.when <= q->e[c].when) break;
+    q->e[i] = q->e[c];
+    i = c;
+  }
+  if (q->n > 0) q->e[i] = last;
+  return top;
+}
+
+// Run the events in `q` which are due at `now`. The periodic ones are put
+// back before the handler is called, so that the handler can add events.
+static void eq_run(EventQueue *q, uint64_t now) {
+  while (q->n > 0 && q->e[0].when <= now) {
+    Event e = eq_pop(q);
+    if (e.period != 0) {
+      Event next = e;
+      next.when += e.period;
+      // do not try to catch up after a long pause (e.g. in sdb)
+      if (next.when <= now) next.when = now + e.period;
+      eq_push(q, next);
+    }
+    e.handler();
+  }
+}
+
+void add_inst_event(uint64_t delay, uint64_t period, event_handler_t handler) {
+  eq_push(&inst_queue, (Event){ .when = g_nr_guest_inst + delay, .period = period, .handler = handler });
+  next_event = inst_queue.e[0].when;
+}
+
+void add_host_event(uint64_t delay, uint64_t period, event_handler_t handler) {
+  eq_push(&host_queue, (Event){ .when = get_time() + delay, .period = period, .handler = handler });
+}
+
+// Read the host time and run the host events. The next poll is scheduled by
+// the number of instructions expected to run until the earliest deadline,
+// estimated from the speed since the last poll.
+static void host_poll() {
+  static uint64_t last_inst = 0, last_time = 0;
+  uint64_t now = get_time();
+  eq_run(&host_queue, now);
+
+  uint64_t interval = HOST_POLL_MIN;
+  uint64_t dinst = g_nr_guest_inst - last_inst, dtime = now - last_time;
+  if (host_queue.n > 0 && dtime > 0) {
+    uint64_t wait = host_queue.e[0].when - now;
+    interval = dinst * wait / dtime;
+    if (interval < HOST_POLL_MIN) interval = HOST_POLL_MIN;
+    if (interval > HOST_POLL_MAX) interval = HOST_POLL_MAX;
+  }
+  last_inst = g_nr_guest_inst;
+  last_time = now;
+  add_inst_event(interval, 0, host_poll);
+}
+
+uint64_t get_guest_time() {
+  return MUXDEF(CONFIG_TIMER_VIRTUAL,
+      (g_nr_guest_inst + skipped_inst) * CONFIG_TIMER_VIRTUAL_NS_PER_INST / 1000, get_time());
+}
+
+void add_guest_event(uint64_t delay, uint64_t period, event_handler_t handler) {
+  // with virtual time, the event is due at an exact number of instructions
+  MUXDEF(CONFIG_TIMER_VIRTUAL, add_inst_event(us_to_inst(delay), us_to_inst(period), handler),
+      add_host_event(delay, period, handler));
+}
+
+void event_skip_idle() {
+#ifdef CONFIG_TIMER_VIRTUAL
+  IFDEF(CONFIG_MULTI_HART, device_lock());
+  uint64_t when = UINT64_MAX;
+  for (int i = 0; i < inst_queue.n; i ++) {
+    Event *e = &inst_queue.e[i];
+    // polling the host does not wake up the guest
+    if (e->handler != host_poll && e->when < when) when = e->when;
+  }
+  if (when == UINT64_MAX || when <= g_nr_guest_inst) {
+    IFDEF(CONFIG_MULTI_HART, device_unlock());
+    return;
+  }
+
+  // Move every event closer instead of increasing g_nr_guest_inst, which
+  // still counts the instructions really executed. This keeps the order of
+  // the heap.
+  uint64_t delta = when - g_nr_guest_inst;
+  for (int i = 0; i < inst_queue.n; i ++) {
+    Event *e = &inst_queue.e[i];
+    e->when = (e->when > delta ? e->when - delta : 0);
+  }
+  skipped_inst += delta;
+  next_event = inst_queue.e[0].when;
+  IFDEF(CONFIG_MULTI_HART, device_unlock());
+#endif
+}
+
+#ifdef CONFIG_TIMER_SKIP_BUSY_WAIT
+// A guest polling the devices with few instructions between the polls is
+// busy-waiting. After IDLE_POLL_COUNT such polls in a row, let the time
+// pass until the next event instead of running the loop.
+#define IDLE_LOOP_MAX_INST 64
+#define IDLE_POLL_COUNT 32
+#define IDLE_SLEEP_MAX_US 1000
+
+#ifndef CONFIG_TIMER_VIRTUAL
+// make host_poll() run after the current instruction
+static void host_poll_soon() {
+  EventQueue q = inst_queue;
+  inst_queue.n = 0;
+  for (int i = 0; i < q.n; i ++) {
+    Event e = q.e[i];
+    if (e.handler == host_poll) e.when = g_nr_guest_inst;
+    eq_push(&inst_queue, e);
+  }
+  next_event = inst_queue.e[0].when;
+}
+#endif
+
+void event_idle_poll() {
+  static uint64_t last_inst = 0;
+  static int nr_poll = 0;
+  nr_poll = (g_nr_guest_inst - last_inst <= IDLE_LOOP_MAX_INST ? nr_poll + 1 : 0);
+  last_inst = g_nr_guest_inst;
+  if (nr_poll < IDLE_POLL_COUNT) return;
+  nr_poll = 0;
+#ifdef CONFIG_TIMER_VIRTUAL
+  event_skip_idle();
+#else
+  uint64_t now = get_time();
+  uint64_t wait = (host_queue.n > 0 && host_queue.e[0].when > now ? host_queue.e[0].when - now : 0);
+  if (wait > IDLE_SLEEP_MAX_US) wait = IDLE_SLEEP_MAX_US;
+  IFNDEF(CONFIG_TARGET_AM, if (wait > 0) usleep(wait));
+  host_poll_soon();
+#endif
+}
+#else
+void event_idle_poll() { }
+#endif
+
+// called by hart 0, while the other harts may access the devices
+void event_update() {
+  IFDEF(CONFIG_MULTI_HART, device_lock());
+  eq_run(&inst_queue, g_nr_guest_inst);
+  next_event = (inst_queue.n > 0 ? inst_queue.e[0].when : UINT64_MAX);
+  IFDEF(CONFIG_MULTI_HART, device_unlock());
+}
+
+void init_event() {
+  add_inst_event(0, 0, host_poll);
+}
@@ -14,16 +14,17 @@
 #**************************************************************************************/
 
 DIRS-y += src/device/io
-SRCS-$(CONFIG_DEVICE) += src/device/device.c src/device/alarm.c src/device/intr.c
+SRCS-$(CONFIG_DEVICE) += src/device/device.c src/device/event.c src/device/alarm.c src/device/intr.c
 SRCS-$(CONFIG_HAS_SERIAL) += src/device/serial.c
 SRCS-$(CONFIG_HAS_TIMER) += src/device/timer.c
 SRCS-$(CONFIG_HAS_KEYBOARD) += src/device/keyboard.c
 SRCS-$(CONFIG_HAS_VGA) += src/device/vga.c
 SRCS-$(CONFIG_HAS_AUDIO) += src/device/audio.c
 SRCS-$(CONFIG_HAS_DISK) += src/device/disk.c
-SRCS-$(CONFIG_HAS_SDCARD) += src/device/sdcard.c
+SRCS-$(CONFIG_HAS_SDCARD) += src/device/sdcard.c src/device/blkcache.c
 
 SRCS-BLACKLIST-$(CONFIG_TARGET_AM) += src/device/alarm.c
+LIBS += $(if $(CONFIG_SERIAL_INPUT_FIFO)$(CONFIG_HAS_SDCARD)$(CONFIG_VGA_SHOW_SCREEN),-lpthread,)
 
 ifdef CONFIG_DEVICE
 ifndef CONFIG_TARGET_AM
@@ -14,6 +14,11 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <device/event.h>
 
+// The interrupt is taken at the next check of the events instead of after
+// every instruction. Only hart 0 receives it.
 void dev_raise_intr() {
+  isa_pend_intr();
+  event_kick();
 }
@@ -39,6 +39,13 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
   if (in_pmem(left) || in_pmem(right)) {
     report_mmio_overlap(name, left, right, "pmem", PMEM_LEFT, PMEM_RIGHT);
   }
+#ifdef CONFIG_MEM_REGIONS
+  // a map may also cover a whole region
+  MemRegion *r = find_mem_region_overlap(left, right);
+  if (r != NULL) {
+    report_mmio_overlap(name, left, right, r->name, r->base, r->base + r->size - 1);
+  }
+#endif
   for (int i = 0; i < nr_map; i++) {
     if (left <= maps[i].high && right >= maps[i].low) {
       report_mmio_overlap(name, left, right, maps[i].name, maps[i].low, maps[i].high);
@@ -53,11 +60,24 @@ void add_mmio_map(const char *name, paddr_t addr, void *space, uint32_t len, io_
   nr_map ++;
 }
 
+#ifdef CONFIG_MULTI_HART
+#include <pthread.h>
+
+static pthread_mutex_t device_mutex = PTHREAD_MUTEX_INITIALIZER;
+void device_lock()   { pthread_mutex_lock(&device_mutex); }
+void device_unlock() { pthread_mutex_unlock(&device_mutex); }
+#endif
+
 /* bus interface */
 word_t mmio_read(paddr_t addr, int len) {
-  return map_read(addr, len, fetch_mmio_map(addr));
+  IFDEF(CONFIG_MULTI_HART, device_lock());
+  word_t ret = map_read(addr, len, fetch_mmio_map(addr));
+  IFDEF(CONFIG_MULTI_HART, device_unlock());
+  return ret;
 }
 
 void mmio_write(paddr_t addr, int len, word_t data) {
+  IFDEF(CONFIG_MULTI_HART, device_lock());
   map_write(addr, len, data, fetch_mmio_map(addr));
+  IFDEF(CONFIG_MULTI_HART, device_unlock());
 }
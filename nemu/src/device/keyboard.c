@@ -14,6 +14,7 @@
 ***************************************************************************************/
 
 #include <device/map.h>
+#include <device/event.h>
 #include <utils.h>
 
 #define KEYDOWN_MASK 0x8000
@@ -46,27 +47,108 @@ static void init_keymap() {
 }
 
 #define KEY_QUEUE_LEN 1024
-static int key_queue[KEY_QUEUE_LEN] = {};
-static int key_f = 0, key_r = 0;
+
+// Filled by the UI thread (or the replay) and drained by the CPU thread
+// without locks. When the queue is full, the producer drops the oldest key
+// by advancing the head too, so both sides claim the head with a CAS.
+static uint32_t key_queue[KEY_QUEUE_LEN] = {};
+static uint64_t key_head = 0, key_tail = 0;
+static uint32_t last_key = NEMU_KEY_NONE;
 
 static void key_enqueue(uint32_t am_scancode) {
-  key_queue[key_r] = am_scancode;
-  key_r = (key_r + 1) % KEY_QUEUE_LEN;
-  Assert(key_r != key_f, "key queue overflow!");
+  uint64_t tail = key_tail;
+  uint64_t head = __atomic_load_n(&key_head, __ATOMIC_ACQUIRE);
+  while (tail - head == KEY_QUEUE_LEN) {
+    // drop the oldest, the head is reloaded if the consumer has taken it
+    if (__atomic_compare_exchange_n(&key_head, &head, head + 1, false,
+          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) break;
+  }
+  __atomic_store_n(&key_queue[tail % KEY_QUEUE_LEN], am_scancode, __ATOMIC_RELAXED);
+  __atomic_store_n(&key_tail, tail + 1, __ATOMIC_RELEASE);
+  last_key = am_scancode;
 }
 
 static uint32_t key_dequeue() {
-  uint32_t key = NEMU_KEY_NONE;
-  if (key_f != key_r) {
-    key = key_queue[key_f];
-    key_f = (key_f + 1) % KEY_QUEUE_LEN;
+  uint64_t head = __atomic_load_n(&key_head, __ATOMIC_ACQUIRE);
+  while (head != __atomic_load_n(&key_tail, __ATOMIC_ACQUIRE)) {
+    uint32_t key = __atomic_load_n(&key_queue[head % KEY_QUEUE_LEN], __ATOMIC_RELAXED);
+    // fails if the key has just been dropped by the producer
+    if (__atomic_compare_exchange_n(&key_head, &head, head + 1, false,
+          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) return key;
   }
-  return key;
+  return NEMU_KEY_NONE;
 }
 
-void send_key(uint8_t scancode, bool is_keydown) {
+void key_clear() {
+  while (key_dequeue() != NEMU_KEY_NONE);
+}
+
+#ifdef CONFIG_KEYBOARD_REPLAY
+
+#define NEMU_KEY_STR(k) [NEMU_KEY_ ## k] = #k,
+static const char *keyname[] = {
+  MAP(NEMU_KEYS, NEMU_KEY_STR)
+};
+
+typedef struct {
+  uint64_t ms;
+  uint32_t am_scancode;
+} KeyRecord;
+
+static KeyRecord *records = NULL;
+static int nr_record = 0, replay_idx = 0;
+static bool is_replay = false;
+
+static void replay_next() {
+  uint64_t now = get_guest_time();
+  while (replay_idx < nr_record && records[replay_idx].ms * 1000 <= now) {
+    key_enqueue(records[replay_idx ++].am_scancode);
+  }
+  if (replay_idx < nr_record) add_guest_event(records[replay_idx].ms * 1000 - now, 0, replay_next);
+}
+
+// each line is "<time in ms of guest time> <key name> <down|up>"
+static void init_replay(const char *path) {
+  if (path[0] == '\0') {
+    Log("No key replay file is given, the keys come from the SDL window");
+    return;
+  }
+  is_replay = true;
+  FILE *fp = fopen(path, "r");
+  Assert(fp, "Can not open key replay file '%s'", path);
+  int cap = 0;
+  uint64_t ms;
+  char name[32], action[8];
+  while (fscanf(fp, "%" SCNu64 " %31s %7s", &ms, name, action) == 3) {
+    int k;
+    for (k = 1; k < ARRLEN(keyname); k ++) {
+      if (strcmp(keyname[k], name) == 0) break;
+    }
+    Assert(k < ARRLEN(keyname), "unknown key '%s' in '%s'", name, path);
+    if (nr_record == cap) {
+      cap = (cap == 0 ? 64 : cap * 2);
+      records = realloc(records, sizeof(records[0]) * cap);
+      assert(records);
+    }
+    records[nr_record ++] = (KeyRecord) { .ms = ms,
+      .am_scancode = k | (strcmp(action, "down") == 0 ? KEYDOWN_MASK : 0) };
+  }
+  fclose(fp);
+  Log("Replay %d key events from %s", nr_record, path);
+  if (nr_record > 0) add_guest_event(records[0].ms * 1000, 0, replay_next);
+}
+#endif
+
+// called from the UI thread
+void send_key(uint8_t scancode, bool is_keydown, bool is_repeat) {
+  // the keys are from the replay file instead
+  if (MUXDEF(CONFIG_KEYBOARD_REPLAY, is_replay, false)) return;
   if (nemu_state.state == NEMU_RUNNING && keymap[scancode] != NEMU_KEY_NONE) {
     uint32_t am_scancode = keymap[scancode] | (is_keydown ? KEYDOWN_MASK : 0);
+    // A held key repeats its keydown. Keep only one if the guest has not
+    // read it yet.
+    if (is_repeat && am_scancode == last_key &&
+        __atomic_load_n(&key_head, __ATOMIC_ACQUIRE) != key_tail) return;
     key_enqueue(am_scancode);
   }
 }
@@ -86,6 +168,7 @@ static void i8042_data_io_handler(uint32_t offset, int len, bool is_write) {
   assert(!is_write);
   assert(offset == 0);
   i8042_data_port_base[0] = key_dequeue();
+  if (i8042_data_port_base[0] == NEMU_KEY_NONE) event_idle_poll();
 }
 
 void init_i8042() {
@@ -97,4 +180,5 @@ void init_i8042() {
   add_mmio_map("keyboard", CONFIG_I8042_DATA_MMIO, i8042_data_port_base, 4, i8042_data_io_handler);
 #endif
   IFNDEF(CONFIG_TARGET_AM, init_keymap());
+  IFDEF(CONFIG_KEYBOARD_REPLAY, init_replay(CONFIG_KEYBOARD_REPLAY_PATH));
 }
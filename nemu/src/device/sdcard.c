@@ -15,6 +15,8 @@
 
 #include <device/map.h>
 #include "mmc.h"
+#include "blkcache.h"
+#include <fcntl.h>
 
 // http://www.files.e-shop.co.il/pdastore/Tech-mmc-samsung/SEC%20MMC%20SPEC%20ver09.pdf
 
@@ -40,19 +42,53 @@ enum {
   SDHBLC
 };
 
-static FILE *fp = NULL;
+// blocks to read ahead if the count is not given by MMC_SET_BLOCK_COUNT
+#define READ_AHEAD 32
+
+static int fd = -1;
 static uint32_t *base = NULL;
 static uint32_t blkcnt = 0;
+// the block count of the current command, 0 if it ends by MMC_STOP_TRANSMISSION
+static uint32_t cmd_blkcnt = 0;
 static long blk_addr = 0;
 static uint32_t addr = 0;
 static bool write_cmd = 0;
 static bool read_ext_csd = false;
+// the cached block accessed by SDDATA
+static uint8_t *cur = NULL;
+static uint64_t cur_blkno = 0;
+
+static void finish_rw() {
+  if (fd < 0 || !write_cmd) return;
+  if (cur != NULL) blkcache_dirty(cur_blkno);
+  // the blocks of a command are written back together
+  if (addr > 0) blkcache_writeback(blk_addr, (addr + BLK_SIZE - 1) / BLK_SIZE);
+  cur = NULL;
+  write_cmd = false;
+}
 
 static void prepare_rw(int is_write) {
+  finish_rw();
   blk_addr = base[SDARG];
   addr = 0;
-  if (fp) fseek(fp, blk_addr << 9, SEEK_SET);
+  cur = NULL;
   write_cmd = is_write;
+  // MMC_SET_BLOCK_COUNT only applies to the next command
+  cmd_blkcnt = blkcnt;
+  blkcnt = 0;
+  if (fd >= 0 && !is_write) blkcache_readahead(blk_addr, cmd_blkcnt ? cmd_blkcnt : READ_AHEAD);
+}
+
+static void sdcard_data(uint32_t *data) {
+  uint64_t blkno = blk_addr + addr / BLK_SIZE;
+  if (cur == NULL || blkno != cur_blkno) {
+    if (cur != NULL && write_cmd) blkcache_dirty(cur_blkno);
+    cur = blkcache_get(blkno, write_cmd);
+    cur_blkno = blkno;
+  }
+  uint8_t *p = cur + addr % BLK_SIZE;
+  if (write_cmd) memcpy(p, data, 4);
+  else memcpy(data, p, 4);
 }
 
 static void sdcard_handle_cmd(int cmd) {
@@ -82,7 +118,7 @@ static void sdcard_handle_cmd(int cmd) {
     case MMC_READ_MULTIPLE_BLOCK: prepare_rw(false); break;
     case MMC_WRITE_MULTIPLE_BLOCK: prepare_rw(true); break;
     case MMC_SEND_STATUS: base[SDRSP0] = 0x900; base[SDRSP1] = base[SDRSP2] = base[SDRSP3] = 0; break;
-    case MMC_STOP_TRANSMISSION: break;
+    case MMC_STOP_TRANSMISSION: finish_rw(); break;
     default:
       panic("unhandled command = %d", cmd);
   }
@@ -109,12 +145,12 @@ static void sdcard_io_handler(uint32_t offset, int len, bool is_write) {
          }
          base[SDDATA] = data;
          if (addr == 512 - 4) read_ext_csd = false;
-       } else if (fp) {
-         __attribute__((unused)) int ret;
-         if (!write_cmd) { ret = fread(&base[SDDATA], 4, 1, fp); }
-         else { ret = fwrite(&base[SDDATA], 4, 1, fp); }
+       } else if (fd >= 0) {
+         sdcard_data(&base[SDDATA]);
        }
        addr += 4;
+       // no MMC_STOP_TRANSMISSION after a write with a block count
+       if (write_cmd && cmd_blkcnt > 0 && addr == cmd_blkcnt * BLK_SIZE) finish_rw();
        break;
     default:
       Log("offset = 0x%x(idx = %d), is_write = %d, data = 0x%x", offset, idx, is_write, base[idx]);
@@ -129,6 +165,7 @@ void init_sdcard() {
   Assert(C_SIZE < (1 << 12), "shoule be fit in 12 bits");
 
   const char *img = CONFIG_SDCARD_IMG_PATH;
-  fp = fopen(img, "r+");
-  if (fp == NULL) Log("Can not find sdcard image: %s", img);
+  fd = open(img, O_RDWR);
+  if (fd < 0) Log("Can not find sdcard image: %s", img);
+  else blkcache_init(fd);
 }
@@ -15,28 +15,126 @@
 
 #include <utils.h>
 #include <device/map.h>
+#include <device/event.h>
+#include <device/alarm.h>
 
 /* http://en.wikibooks.org/wiki/Serial_Programming/8250_UART_Programming */
 // NOTE: this is compatible to 16550
 
-#define CH_OFFSET 0
+#define CH_OFFSET  0
+#define LCR_OFFSET 3
+#define LSR_OFFSET 5
+
+#define LCR_DLAB 0x80 // offset 0 and 1 are the divisor latch
+#define LSR_DR   0x01 // data ready
+#define LSR_THRE 0x20 // transmitter holding register empty
+#define LSR_TEMT 0x40 // transmitter empty
 
 static uint8_t *serial_base = NULL;
 
+#ifdef CONFIG_TARGET_AM
+static void serial_putc(char ch) { putch(ch); }
+static bool serial_getc(uint8_t *ch) { return false; }
+void serial_flush() {}
+#else
+#include <unistd.h>
+
+// Output is collected and written to the host stderr in bulk, at a
+// newline, when the buffer is full, periodically and at exit. It is also
+// flushed when NEMU aborts or panics, and before a checkpoint is forked.
+static char obuf[4096];
+static int olen = 0;
+
+void serial_flush() {
+  if (olen > 0) {
+    fwrite(obuf, 1, olen, stderr);
+    olen = 0;
+  }
+}
 
 static void serial_putc(char ch) {
-  MUXDEF(CONFIG_TARGET_AM, putch(ch), putc(ch, stderr));
+  obuf[olen ++] = ch;
+  if (ch == '\n' || olen == sizeof(obuf)) serial_flush();
+}
+
+#ifdef CONFIG_SERIAL_INPUT_FIFO
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define FIFO_PATH "/tmp/nemu.serial"
+#define RX_SIZE 1024 // power of 2
+
+// filled by the I/O thread and drained by the guest
+static uint8_t rx[RX_SIZE];
+static uint32_t rx_head = 0, rx_tail = 0;
+
+static bool serial_getc(uint8_t *ch) {
+  uint32_t tail = __atomic_load_n(&rx_tail, __ATOMIC_ACQUIRE);
+  if (rx_head == tail) return false;
+  *ch = rx[rx_head % RX_SIZE];
+  __atomic_store_n(&rx_head, rx_head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+static bool serial_rx_ready() {
+  return __atomic_load_n(&rx_tail, __ATOMIC_ACQUIRE) != rx_head;
+}
+
+static void *rx_thread(void *arg) {
+  uint8_t buf[256];
+  while (true) {
+    // blocks until a writer shows up, and reopens after it leaves
+    int fd = open(FIFO_PATH, O_RDONLY);
+    if (fd < 0) return NULL;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+      for (int i = 0; i < n; i ++) {
+        while (rx_tail - __atomic_load_n(&rx_head, __ATOMIC_ACQUIRE) == RX_SIZE) usleep(1000);
+        rx[rx_tail % RX_SIZE] = buf[i];
+        __atomic_store_n(&rx_tail, rx_tail + 1, __ATOMIC_RELEASE);
+      }
+    }
+    close(fd);
+  }
+}
+
+static void init_fifo() {
+  if (mkfifo(FIFO_PATH, 0666) != 0) {
+    struct stat st;
+    Assert(stat(FIFO_PATH, &st) == 0 && S_ISFIFO(st.st_mode), "Can not create FIFO " FIFO_PATH);
+  }
+  pthread_t t;
+  int ret = pthread_create(&t, NULL, rx_thread, NULL);
+  Assert(ret == 0, "Can not create the serial input thread");
+  pthread_detach(t);
+  Log("Serial input from " FIFO_PATH);
+}
+#else
+static bool serial_getc(uint8_t *ch) { return false; }
+#endif
+#endif
+
+static uint8_t serial_lsr() {
+  bool ready = MUXDEF(CONFIG_SERIAL_INPUT_FIFO, serial_rx_ready(), false);
+  return LSR_THRE | LSR_TEMT | (ready ? LSR_DR : 0);
 }
 
 static void serial_io_handler(uint32_t offset, int len, bool is_write) {
   assert(len == 1);
+  bool dlab = serial_base[LCR_OFFSET] & LCR_DLAB;
   switch (offset) {
     /* We bind the serial port with the host stderr in NEMU. */
     case CH_OFFSET:
+      if (dlab) break;
       if (is_write) serial_putc(serial_base[0]);
-      else panic("do not support read");
+      else serial_getc(&serial_base[0]); // keep the last byte if there is no input
+      break;
+    case LSR_OFFSET:
+      if (!is_write) serial_base[LSR_OFFSET] = serial_lsr();
       break;
-    default: panic("do not support offset = %d", offset);
+    // the other registers only hold what the guest writes
+    default: break;
   }
 }
 
@@ -48,4 +146,10 @@ void init_serial() {
   add_mmio_map("serial", CONFIG_SERIAL_MMIO, serial_base, 8, serial_io_handler);
 #endif
 
+#ifndef CONFIG_TARGET_AM
+  // also flush a line without newline, e.g. a prompt
+  add_host_event(1000000 / TIMER_HZ, 1000000 / TIMER_HZ, serial_flush);
+  atexit(serial_flush);
+  IFDEF(CONFIG_SERIAL_INPUT_FIFO, init_fifo());
+#endif
 }
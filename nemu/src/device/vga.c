@@ -62,18 +62,41 @@ static inline void update_screen() {
   SDL_RenderCopy(renderer, texture, NULL, NULL);
   SDL_RenderPresent(renderer);
 }
+
+// The window is owned by the UI thread (see device.c), which redraws
+// it once the CPU thread has seen the sync register.
+static bool screen_dirty = false;
+
+void vga_ui_init() {
+  init_screen();
+}
+
+void vga_ui_update() {
+  if (__atomic_exchange_n(&screen_dirty, false, __ATOMIC_ACQ_REL)) update_screen();
+}
+
+static inline void sync_screen() {
+  __atomic_store_n(&screen_dirty, true, __ATOMIC_RELEASE);
+}
 #else
 static void init_screen() {}
 
 static inline void update_screen() {
   io_write(AM_GPU_FBDRAW, 0, 0, vmem, screen_width(), screen_height(), true);
 }
+
+static inline void sync_screen() {
+  update_screen();
+}
 #endif
 #endif
 
 void vga_update_screen() {
-  // TODO: call `update_screen()` when the sync register is non-zero,
-  // then zero out the sync register
+  uint32_t *sync = &vgactl_port_base[1];
+  if (*sync) {
+    IFDEF(CONFIG_VGA_SHOW_SCREEN, sync_screen());
+    *sync = 0;
+  }
 }
 
 void init_vga() {
@@ -87,6 +110,6 @@ void init_vga() {
 
   vmem = new_space(screen_size());
   add_mmio_map("vmem", CONFIG_FB_ADDR, vmem, screen_size(), NULL);
-  IFDEF(CONFIG_VGA_SHOW_SCREEN, init_screen());
+  IFDEF(CONFIG_VGA_SHOW_SCREEN, IFDEF(CONFIG_TARGET_AM, init_screen()));
   IFDEF(CONFIG_VGA_SHOW_SCREEN, memset(vmem, 0, screen_size()));
 }
@@ -14,23 +14,35 @@
 ***************************************************************************************/
 
 #include <utils.h>
-#include <cpu/ifetch.h>
+#include <cpu/cpu.h>
 #include <isa.h>
 #include <cpu/difftest.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+void serial_flush();
 
 void set_nemu_state(int state, vaddr_t pc, int halt_ret) {
   difftest_skip_ref();
+  // keep the mismatch reported by difftest when catching up with REF
+  if (nemu_state.state == NEMU_ABORT) return;
+  IFDEF(CONFIG_HAS_SERIAL, if (state == NEMU_ABORT) serial_flush());
   nemu_state.state = state;
   nemu_state.halt_pc = pc;
   nemu_state.halt_ret = halt_ret;
 }
 
+// only to show the bytes, an unmapped page must not raise a page fault
+static uint32_t peek_inst(vaddr_t pc) {
+  paddr_t paddr;
+  return (vaddr_probe(pc, 4, MEM_TYPE_IFETCH, &paddr) ? paddr_read(paddr, 4) : 0);
+}
+
 __attribute__((noinline))
 void invalid_inst(vaddr_t thispc) {
   uint32_t temp[2];
-  vaddr_t pc = thispc;
-  temp[0] = inst_fetch(&pc, 4);
-  temp[1] = inst_fetch(&pc, 4);
+  temp[0] = peek_inst(thispc);
+  temp[1] = peek_inst(thispc + 4);
 
   uint8_t *p = (uint8_t *)temp;
   printf("invalid opcode(PC = " FMT_WORD "):\n"
@@ -49,3 +61,41 @@ void invalid_inst(vaddr_t thispc) {
 
   set_nemu_state(NEMU_ABORT, thispc, -1);
 }
+
+#ifdef CONFIG_HOSTCALL
+// The host memory of the virtual range [addr, addr + n), NULL if it is not
+// in the memory or its pages are not physically contiguous.
+static uint8_t *guest_range(vaddr_t addr, word_t n, int type, paddr_t *paddr) {
+  if (!vaddr_translate(addr, 1, type, paddr)) return NULL;
+  uint8_t *host = paddr_to_host(*paddr, n);
+  if (host == NULL) return NULL;
+  for (word_t off = PAGE_SIZE - (addr & PAGE_MASK); off < n; off += PAGE_SIZE) {
+    paddr_t p;
+    if (!vaddr_translate(addr + off, 1, type, &p) || p != *paddr + off) return NULL;
+  }
+  return host;
+}
+
+// REF does not know the instruction: it only gets the memory written and
+// the registers of DUT, also when the call fails and returns -1.
+word_t hostcall(vaddr_t pc, int id, word_t a0, word_t a1, word_t a2) {
+  difftest_skip_ref();
+  word_t n = a2;
+  paddr_t dst_paddr, src_paddr;
+  uint8_t *dst = guest_range(a0, n, MEM_TYPE_WRITE, &dst_paddr);
+  if (dst == NULL) return -1;
+  switch (id) {
+    case HOSTCALL_MEMCPY: {
+      uint8_t *src = guest_range(a1, n, MEM_TYPE_READ, &src_paddr);
+      if (src == NULL) return -1;
+      // klib also uses it for memmove()
+      memmove(dst, src, n);
+      break;
+    }
+    case HOSTCALL_MEMSET: memset(dst, a1, n); break;
+    default: return -1;
+  }
+  if (n > 0) difftest_dma(dst_paddr, n);
+  return 0;
+}
+#endif
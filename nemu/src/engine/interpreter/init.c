@@ -16,12 +16,14 @@
 #include <cpu/cpu.h>
 
 void sdb_mainloop();
+bool gdb_mainloop();
 
 void engine_start() {
 #ifdef CONFIG_TARGET_AM
   cpu_exec(-1);
 #else
-  /* Receive commands from user. */
+  /* Receive commands from gdb or the user. */
+  IFDEF(CONFIG_GDB_STUB, if (gdb_mainloop()) return);
   sdb_mainloop();
 #endif
 }
@@ -20,3 +20,13 @@
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
   return MEM_RET_FAIL;
 }
+
+paddr_t isa_mmu_probe(vaddr_t vaddr, int len, int type) {
+  return MEM_RET_FAIL;
+}
+
+void isa_mmu_fault(vaddr_t vaddr, int type) {
+}
+
+void isa_mmu_statistic() {
+}
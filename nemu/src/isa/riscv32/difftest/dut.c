@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <cpu/difftest.h>
+#include <cpu/decode.h>
 #include "../local-include/reg.h"
 
 // 将NEMU的寄存器状态拷贝给REF
@@ -31,26 +32,51 @@ void isa_difftest_regcpy(void *dut_reg, bool direction) {
     ((uint64_t *)dut_reg)[32] = cpu.pc;
   }
 }
-bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
+bool isa_difftest_checkregs_with(CPU_state *ref_r, CPU_state *dut_r, vaddr_t pc) {
   // 检查32个通用寄存器
   for (int i = 0; i < 32; i++) {
-    if (ref_r->gpr[i] != cpu.gpr[i]) {
+    if (ref_r->gpr[i] != dut_r->gpr[i]) {
       Log("difftest: GPR[%d] (%s) is different after executing instruction at pc = 0x%08x",
           i, reg_name(i), pc);
-      Log("           REF = 0x%08x, DUT = 0x%08x", ref_r->gpr[i], cpu.gpr[i]);
+      Log("           REF = 0x%08x, DUT = 0x%08x", ref_r->gpr[i], dut_r->gpr[i]);
       return false; // 发现不一致, 返回false
     }
   }
 
   // 检查PC
-  if (ref_r->pc != cpu.pc) {
+  if (ref_r->pc != dut_r->pc) {
     Log("difftest: PC is different after executing instruction at pc = 0x%08x", pc);
-    Log("           REF = 0x%08x, DUT = 0x%08x", ref_r->pc, cpu.pc);
+    Log("           REF = 0x%08x, DUT = 0x%08x", ref_r->pc, dut_r->pc);
     return false; // 发现不一致, 返回false
   }
 
   return true; // 所有寄存器都一致, 返回true
 }
 
+bool isa_difftest_checkregs(CPU_state *ref_r, vaddr_t pc) {
+  return isa_difftest_checkregs_with(ref_r, &cpu, pc);
+}
+
+// 返回刚执行的指令写入的通用寄存器编号, 不写寄存器时返回-1
+int isa_difftest_commit_reg(Decode *s, word_t *val) {
+  uint32_t i = s->isa.expanded;
+  int rd = BITS(i, 11, 7);
+  switch (BITS(i, 6, 0)) {
+    case 0x23: case 0x63: return -1; // store, branch
+    // ecall, mret and so on, csrr* write rd
+    case 0x73: if (BITS(i, 14, 12) == 0) return -1; break;
+    // hostcall, rd is x0 in the encoding but the result is in a0
+    case 0x0b: if (BITS(i, 14, 12) == 0) rd = 10; break;
+  }
+  if (rd == 0) return -1;
+  *val = gpr(rd);
+  return rd;
+}
+
+void isa_difftest_commit_apply(CPU_state *r, int rd, word_t val, vaddr_t npc) {
+  if (rd >= 0) r->gpr[rd] = val;
+  r->pc = npc;
+}
+
 void isa_difftest_attach() {
 }
@@ -21,13 +21,27 @@
 typedef struct {
   word_t gpr[MUXDEF(CONFIG_RVE, 16, 32)];
   vaddr_t pc;
+  word_t mhartid;
+  // reservation of lr/sc
+  paddr_t lr_addr;
+  word_t lr_val;
+  bool lr_valid;
+  // machine-mode CSRs, mip is also set by the devices
+  word_t mstatus, mie, mip, mtvec, mscratch, mepc, mcause, mtval;
+  word_t satp;
 } MUXDEF(CONFIG_RV64, riscv64_CPU_state, riscv32_CPU_state);
 
 // decode
 typedef struct {
-  uint32_t inst;
+  uint32_t inst;     // as fetched, 16 bits for the C extension
+  uint32_t expanded; // in the 32-bit form
 } MUXDEF(CONFIG_RV64, riscv64_ISADecodeInfo, riscv32_ISADecodeInfo);
 
+#ifdef CONFIG_RV_SV32
+// Sv32 if satp.MODE is set, in any mode since there is only M-mode
+#define isa_mmu_check(vaddr, len, type) (unlikely(cpu.satp >> 31) ? MMU_TRANSLATE : MMU_DIRECT)
+#else
 #define isa_mmu_check(vaddr, len, type) (MMU_DIRECT)
+#endif
 
 #endif
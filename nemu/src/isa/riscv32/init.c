@@ -15,6 +15,7 @@
 
 #include <isa.h>
 #include <memory/paddr.h>
+#include "local-include/reg.h"
 
 // this is not consistent with uint8_t
 // but it is ok since we do not access the array directly
@@ -32,6 +33,19 @@ static void restart() {
 
   /* The zero register is always 0. */
   cpu.gpr[0] = 0;
+
+  /* Only machine mode is supported. */
+  cpu.mstatus = MSTATUS_MPP;
+
+  IFDEF(CONFIG_MULTI_HART, init_isa_hart(0, RESET_VECTOR));
+}
+
+// called on the thread of the hart
+void init_isa_hart(int hartid, vaddr_t pc) {
+  cpu.pc = pc;
+  cpu.mhartid = hartid;
+  cpu.gpr[10] = hartid;
+  cpu.gpr[11] = MUXDEF(CONFIG_MULTI_HART, CONFIG_NR_HART, 1);
 }
 
 void init_isa() {
@@ -18,9 +18,128 @@
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
 #include "memory/paddr.h"
+#include <memory/host.h>
+#include <device/event.h>
+#include <setjmp.h>
 #define R(i) gpr(i)
-#define Mr vaddr_read
-#define Mw vaddr_write
+// the width is a constant in every instruction, so the access function is
+// selected here instead of dispatching on len at every access
+// a misaligned access is skipped once it stops NEMU, and a load reads 0
+#define Mr(addr, len) (misaligned(s, addr, len) ? 0 : concat(vaddr_read_, len)(addr))
+#define Mw(addr, len, data) (misaligned(s, addr, len) ? (void)0 : concat(vaddr_write_, len)(addr, data))
+
+static inline bool misaligned(Decode *s, vaddr_t addr, int len) {
+#ifdef CONFIG_RV_MISALIGN_TRAP
+  if (unlikely(addr & (len - 1))) {
+    Log("misaligned access at address = " FMT_WORD ", len = %d, pc = " FMT_WORD, addr, len, s->pc);
+    set_nemu_state(NEMU_ABORT, s->pc, -1);
+    return true;
+  }
+#endif
+  return false;
+}
+
+#ifdef CONFIG_RV_ZB
+// Zbb, mapped to the builtins of the host
+static inline word_t clz(word_t x) { return (x == 0 ? 32 : __builtin_clz(x)); }
+static inline word_t ctz(word_t x) { return (x == 0 ? 32 : __builtin_ctz(x)); }
+static inline word_t rol(word_t x, int n) { n &= 0x1f; return (n == 0 ? x : (x << n) | (x >> (32 - n))); }
+static inline word_t ror(word_t x, int n) { return rol(x, -n); }
+
+// 0xff for every non-zero byte, 0 for every zero byte
+static inline word_t orc_b(word_t x) {
+  word_t nonzero = (((x & 0x7f7f7f7f) + 0x7f7f7f7f) | x) & 0x80808080;
+  return (nonzero >> 7) * 0xff;
+}
+#endif
+
+// The A extension works on the host memory with host atomics, so that it
+// is atomic against the other harts. sc succeeds if the word still holds
+// the value loaded by lr, which ignores ABA like most emulators do.
+enum { AMO_SWAP, AMO_ADD, AMO_XOR, AMO_AND, AMO_OR, AMO_MIN, AMO_MAX, AMO_MINU, AMO_MAXU };
+
+static inline word_t amo_calc(int op, word_t old, word_t src) {
+  switch (op) {
+    case AMO_SWAP: return src;
+    case AMO_ADD:  return old + src;
+    case AMO_XOR:  return old ^ src;
+    case AMO_AND:  return old & src;
+    case AMO_OR:   return old | src;
+    case AMO_MIN:  return ((sword_t)old < (sword_t)src ? old : src);
+    case AMO_MAX:  return ((sword_t)old > (sword_t)src ? old : src);
+    case AMO_MINU: return (old < src ? old : src);
+    case AMO_MAXU: return (old > src ? old : src);
+    default: panic("bad amo op = %d", op);
+  }
+}
+
+// the host word at addr, NULL if it is not in the memory or can not be
+// translated, then the access goes the slow way, which also reports a fault
+static uint32_t *amo_host(Decode *s, vaddr_t addr, int type) {
+  paddr_t paddr;
+  if (!vaddr_translate(addr, 4, type, &paddr)) { isa_mmu_fault(addr, type); return NULL; }
+  return (uint32_t *)paddr_to_host(paddr, 4);
+}
+
+static word_t amo(Decode *s, vaddr_t addr, int op, word_t src) {
+  if (misaligned(s, addr, 4)) return 0;
+  uint32_t *p = amo_host(s, addr, MEM_TYPE_WRITE);
+  if (unlikely(p == NULL)) {
+    // not atomic on MMIO
+    word_t old = vaddr_read_4(addr);
+    vaddr_write_4(addr, amo_calc(op, old, src));
+    return old;
+  }
+  switch (op) {
+    case AMO_SWAP: return __atomic_exchange_n(p, src, __ATOMIC_SEQ_CST);
+    case AMO_ADD:  return __atomic_fetch_add(p, src, __ATOMIC_SEQ_CST);
+    case AMO_XOR:  return __atomic_fetch_xor(p, src, __ATOMIC_SEQ_CST);
+    case AMO_AND:  return __atomic_fetch_and(p, src, __ATOMIC_SEQ_CST);
+    case AMO_OR:   return __atomic_fetch_or (p, src, __ATOMIC_SEQ_CST);
+    default: {
+      uint32_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+      while (!__atomic_compare_exchange_n(p, &old, amo_calc(op, old, src), false,
+            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+      return old;
+    }
+  }
+}
+
+static word_t lr(Decode *s, vaddr_t addr) {
+  if (misaligned(s, addr, 4)) return 0;
+  uint32_t *p = amo_host(s, addr, MEM_TYPE_READ);
+  word_t val = (p ? __atomic_load_n(p, __ATOMIC_SEQ_CST) : vaddr_read_4(addr));
+  cpu.lr_addr = addr;
+  cpu.lr_val = val;
+  cpu.lr_valid = true;
+  return val;
+}
+
+static word_t sc(Decode *s, vaddr_t addr, word_t src) {
+  if (misaligned(s, addr, 4)) return 1;
+  bool reserved = cpu.lr_valid && cpu.lr_addr == addr;
+  cpu.lr_valid = false;
+  if (!reserved) return 1;
+  uint32_t *p = amo_host(s, addr, MEM_TYPE_WRITE);
+  if (unlikely(p == NULL)) { vaddr_write_4(addr, src); return 0; }
+  uint32_t expected = cpu.lr_val;
+  return __atomic_compare_exchange_n(p, &expected, src, false,
+      __ATOMIC_SEQ_CST, __ATOMIC_RELAXED) ? 0 : 1;
+}
+
+// Zicsr: csrrs/csrrc with x0 (or a zero uimm) only read the CSR
+enum { CSR_W, CSR_S, CSR_C };
+
+static word_t csr_op(Decode *s, int op, word_t src, bool do_write) {
+  uint32_t addr = BITS(s->isa.expanded, 31, 20);
+  word_t old = 0;
+  if (unlikely(!csr_read(addr, &old))) { INV(s->pc); return 0; }
+  if (do_write) {
+    word_t val = (op == CSR_W ? src : op == CSR_S ? (old | src) : (old & ~src));
+    if (unlikely(!csr_write(addr, val))) { INV(s->pc); return 0; }
+  }
+  return old;
+}
 
 enum {
   TYPE_I, TYPE_U, TYPE_S,TYPE_J,TYPE_B,TYPE_R,
@@ -35,7 +154,7 @@ enum {
 #define immB() do { *imm = SEXT(((BITS(i, 31, 31) << 12) | (BITS(i, 7, 7) << 11) | (BITS(i, 30, 25) << 5) | (BITS(i, 11, 8) << 1)), 13); } while(0)
 #define immJ() do { *imm = SEXT(((BITS(i, 31, 31) << 20) | (BITS(i, 19, 12) << 12) | (BITS(i, 20, 20) << 11) | (BITS(i, 30, 21) << 1)), 21); } while(0)
 static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_t *imm, int type) {
-  uint32_t i = s->isa.inst;
+  uint32_t i = s->isa.expanded;
   int rs1 = BITS(i, 19, 15);
   int rs2 = BITS(i, 24, 20);
   *rd     = BITS(i, 11, 7);
@@ -51,11 +170,115 @@ static void decode_operand(Decode *s, int *rd, word_t *src1, word_t *src2, word_
   }
 }
 
-static int decode_exec(Decode *s)
+// C extension: a 16-bit instruction is expanded to its 32-bit form, so it
+// goes through the same patterns below. 0 is returned for an illegal one.
+#define RV_I(op, f3, rd, rs1, imm) ((BITS(imm, 11, 0) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define RV_S(f3, rs1, rs2, imm) ((BITS(imm, 11, 5) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | \
+    (BITS(imm, 4, 0) << 7) | 0x23)
+#define RV_B(f3, rs1, rs2, imm) ((BITS(imm, 12, 12) << 31) | (BITS(imm, 10, 5) << 25) | ((rs2) << 20) | ((rs1) << 15) | \
+    ((f3) << 12) | (BITS(imm, 4, 1) << 8) | (BITS(imm, 11, 11) << 7) | 0x63)
+#define RV_J(rd, imm) ((BITS(imm, 20, 20) << 31) | (BITS(imm, 10, 1) << 21) | (BITS(imm, 11, 11) << 20) | \
+    (BITS(imm, 19, 12) << 12) | ((rd) << 7) | 0x6f)
+#define RV_U(op, rd, imm) ((BITS(imm, 19, 0) << 12) | ((rd) << 7) | (op))
+#define RV_R(f7, f3, rd, rs1, rs2) (((f7) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | 0x33)
+
+static inline uint32_t rvc_imm_j(uint32_t c) {
+  return SEXT((BITS(c, 12, 12) << 11) | (BITS(c, 8, 8) << 10) | (BITS(c, 10, 9) << 8) | (BITS(c, 6, 6) << 7) |
+      (BITS(c, 7, 7) << 6) | (BITS(c, 2, 2) << 5) | (BITS(c, 11, 11) << 4) | (BITS(c, 5, 3) << 1), 12);
+}
+
+static inline uint32_t rvc_imm_b(uint32_t c) {
+  return SEXT((BITS(c, 12, 12) << 8) | (BITS(c, 6, 5) << 6) | (BITS(c, 2, 2) << 5) |
+      (BITS(c, 11, 10) << 3) | (BITS(c, 4, 3) << 1), 9);
+}
+
+static uint32_t rvc_expand(uint32_t c) {
+  uint32_t rd = BITS(c, 11, 7), rs2 = BITS(c, 6, 2);
+  uint32_t rdp = BITS(c, 4, 2) + 8, rs1p = BITS(c, 9, 7) + 8; // rd', rs2' and rs1'
+  uint32_t imm6 = SEXT((BITS(c, 12, 12) << 5) | BITS(c, 6, 2), 6);
+  uint32_t uimm_w = (BITS(c, 5, 5) << 6) | (BITS(c, 12, 10) << 3) | (BITS(c, 6, 6) << 2);
+  uint32_t imm;
+  switch ((BITS(c, 15, 13) << 2) | BITS(c, 1, 0)) {
+    case 0b00000: // c.addi4spn
+      imm = (BITS(c, 10, 7) << 6) | (BITS(c, 12, 11) << 4) | (BITS(c, 5, 5) << 3) | (BITS(c, 6, 6) << 2);
+      return (imm == 0 ? 0 : RV_I(0x13, 0, rdp, 2, imm));
+    case 0b01000: return RV_I(0x03, 2, rdp, rs1p, uimm_w); // c.lw
+    case 0b11000: return RV_S(2, rs1p, rdp, uimm_w);       // c.sw
+    case 0b00001: return RV_I(0x13, 0, rd, rd, imm6);      // c.addi
+    case 0b00101: return RV_J(1, rvc_imm_j(c));            // c.jal
+    case 0b01001: return RV_I(0x13, 0, rd, 0, imm6);       // c.li
+    case 0b01101:
+      if (rd == 2) { // c.addi16sp
+        imm = SEXT((BITS(c, 12, 12) << 9) | (BITS(c, 4, 3) << 7) | (BITS(c, 5, 5) << 6) |
+            (BITS(c, 2, 2) << 5) | (BITS(c, 6, 6) << 4), 10);
+        return (imm == 0 ? 0 : RV_I(0x13, 0, 2, 2, imm));
+      }
+      return (imm6 == 0 ? 0 : RV_U(0x37, rd, imm6));     // c.lui
+    case 0b10001:
+      switch (BITS(c, 11, 10)) {
+        case 0: return (BITS(c, 12, 12) ? 0 : RV_I(0x13, 5, rs1p, rs1p, rs2));         // c.srli
+        case 1: return (BITS(c, 12, 12) ? 0 : RV_I(0x13, 5, rs1p, rs1p, 0x400 | rs2)); // c.srai
+        case 2: return RV_I(0x13, 7, rs1p, rs1p, imm6);                                // c.andi
+        default: {
+          // c.sub, c.xor, c.or, c.and
+          static const uint32_t f3[] = { 0, 4, 6, 7 };
+          uint32_t op = BITS(c, 6, 5);
+          return (BITS(c, 12, 12) ? 0 : RV_R(op == 0 ? 0x20 : 0, f3[op], rs1p, rs1p, rdp));
+        }
+      }
+    case 0b10101: return RV_J(0, rvc_imm_j(c));                        // c.j
+    case 0b11001: return RV_B(0, rs1p, 0, rvc_imm_b(c));               // c.beqz
+    case 0b11101: return RV_B(1, rs1p, 0, rvc_imm_b(c));               // c.bnez
+    case 0b00010: return (BITS(c, 12, 12) ? 0 : RV_I(0x13, 1, rd, rd, rs2)); // c.slli
+    case 0b01010: // c.lwsp
+      imm = (BITS(c, 3, 2) << 6) | (BITS(c, 12, 12) << 5) | (BITS(c, 6, 4) << 2);
+      return (rd == 0 ? 0 : RV_I(0x03, 2, rd, 2, imm));
+    case 0b10010:
+      if (BITS(c, 12, 12) == 0) {
+        if (rs2 != 0) return RV_R(0, 0, rd, 0, rs2);                    // c.mv
+        return (rd == 0 ? 0 : RV_I(0x67, 0, 0, rd, 0));                // c.jr
+      }
+      if (rs2 != 0) return RV_R(0, 0, rd, rd, rs2);                     // c.add
+      return (rd == 0 ? 0x00100073 : RV_I(0x67, 0, 1, rd, 0));          // c.ebreak, c.jalr
+    case 0b11010: // c.swsp
+      imm = (BITS(c, 8, 7) << 6) | (BITS(c, 12, 9) << 2);
+      return RV_S(2, 2, rs2, imm);
+    default: return 0; // floating point is not supported
+  }
+}
+
+#ifdef CONFIG_DECODE_CACHE
+// Direct-mapped on pc. The fetched instruction is still compared at every
+// hit, which keeps self-modifying code correct without invalidation.
+#define DCACHE_SIZE 4096
+
+typedef struct {
+  vaddr_t pc;
+  uint32_t inst;
+  uint32_t expanded;
+  const void *hit; // the matched pattern in decode_exec()
+#ifdef CONFIG_INST_FUSION
+  uint8_t fuse;      // FUSE_NONE if the next instruction is not fused
+  uint8_t ilen2;
+  uint8_t f_rd, f_rd2, f_rs1, f_rs2;
+  bool f_bne, f_unsigned, f_cmp_imm;
+  uint32_t inst2;    // the next instruction as fetched
+  word_t f_imm, f_imm2;
+#endif
+} DecodeCache;
+
+static HART_LOCAL DecodeCache dcache[DCACHE_SIZE] = {};
+
+#define INSTPAT_HIT(s, label) (dc->hit = (label))
+#else
+typedef struct { const void *hit; } DecodeCache;
+#endif
+
+static int decode_exec(Decode *s, DecodeCache *dc)
 {
   s->dnpc = s->snpc;
 
-#define INSTPAT_INST(s) ((s)->isa.inst)
+#define INSTPAT_INST(s) ((s)->isa.expanded)
 #define INSTPAT_MATCH(s, name, type, ... /* execute body */)         \
   {                                                                  \
     int rd = 0;                                                      \
@@ -65,6 +288,8 @@ static int decode_exec(Decode *s)
   }
 
   INSTPAT_START();
+  // skip the matching for an instruction seen before
+  IFDEF(CONFIG_DECODE_CACHE, if (dc->hit != NULL) goto *dc->hit);
   INSTPAT("??????? ????? ????? ??? ????? 00101 11", auipc, U, R(rd) = s->pc + imm);
   INSTPAT("??????? ????? ????? 100 ????? 00000 11", lbu, I, R(rd) = Mr(src1 + imm, 1));
   INSTPAT("??????? ????? ????? 000 ????? 01000 11", sb, S, Mw(src1 + imm, 1, src2));
@@ -141,18 +366,18 @@ static int decode_exec(Decode *s)
   INSTPAT("??????? ????? ????? 001 ????? 0100011", sh, S, Mw(src1 + imm, 2, src2));
   //// jal (Jump and Link) - J-Type
   INSTPAT("????? ????? ????? ??? ????? 1101111", jal, J, {
-    // 1. Link: 如果目标寄存器 rd 不是 x0, 就保存返回地址 (pc + 4)
+    // 1. Link: 如果目标寄存器 rd 不是 x0, 就保存返回地址 (snpc, c.jal 为 pc + 2)
     if (rd != 0)
     {
-      R(rd) = s->pc + 4;
+      R(rd) = s->snpc;
     }
     // 2. Jump: 设置下一条指令的PC为当前PC + 立即数
     s->dnpc = s->pc + imm;
   });
   //// jalr (Jump and Link Register) - I-Type
   INSTPAT("????? ????? ????? 000 ????? 1100111", jalr, I, {
-    // 暂存一下pc + 4, 作为可能的返回地址
-    word_t link_addr = s->pc + 4;
+    // 暂存一下snpc, 作为可能的返回地址
+    word_t link_addr = s->snpc;
 
     // 直接使用 src1 (代表rs1寄存器的值) 和 imm (代表立即数的值)
     // 计算跳转目标地址，并确保最低位为0
@@ -277,7 +502,60 @@ static int decode_exec(Decode *s)
       R(rd) = src1 % src2;
     }
   });
+#ifdef CONFIG_RV_ZB
+  INSTPAT("0010000 ????? ????? 010 ????? 01100 11", sh1add, R, R(rd) = (src1 << 1) + src2);
+  INSTPAT("0010000 ????? ????? 100 ????? 01100 11", sh2add, R, R(rd) = (src1 << 2) + src2);
+  INSTPAT("0010000 ????? ????? 110 ????? 01100 11", sh3add, R, R(rd) = (src1 << 3) + src2);
+  INSTPAT("0100000 ????? ????? 111 ????? 01100 11", andn  , R, R(rd) = src1 & ~src2);
+  INSTPAT("0100000 ????? ????? 110 ????? 01100 11", orn   , R, R(rd) = src1 | ~src2);
+  INSTPAT("0100000 ????? ????? 100 ????? 01100 11", xnor  , R, R(rd) = ~(src1 ^ src2));
+  INSTPAT("0110000 00000 ????? 001 ????? 00100 11", clz   , R, R(rd) = clz(src1));
+  INSTPAT("0110000 00001 ????? 001 ????? 00100 11", ctz   , R, R(rd) = ctz(src1));
+  INSTPAT("0110000 00010 ????? 001 ????? 00100 11", cpop  , R, R(rd) = __builtin_popcount(src1));
+  INSTPAT("0000101 ????? ????? 110 ????? 01100 11", max   , R, R(rd) = ((sword_t)src1 > (sword_t)src2 ? src1 : src2));
+  INSTPAT("0000101 ????? ????? 111 ????? 01100 11", maxu  , R, R(rd) = (src1 > src2 ? src1 : src2));
+  INSTPAT("0000101 ????? ????? 100 ????? 01100 11", min   , R, R(rd) = ((sword_t)src1 < (sword_t)src2 ? src1 : src2));
+  INSTPAT("0000101 ????? ????? 101 ????? 01100 11", minu  , R, R(rd) = (src1 < src2 ? src1 : src2));
+  INSTPAT("0110000 00100 ????? 001 ????? 00100 11", sext_b, R, R(rd) = SEXT(src1, 8));
+  INSTPAT("0110000 00101 ????? 001 ????? 00100 11", sext_h, R, R(rd) = SEXT(src1, 16));
+  INSTPAT("0000100 00000 ????? 100 ????? 01100 11", zext_h, R, R(rd) = src1 & 0xffff);
+  INSTPAT("0110000 ????? ????? 001 ????? 01100 11", rol   , R, R(rd) = rol(src1, src2));
+  INSTPAT("0110000 ????? ????? 101 ????? 01100 11", ror   , R, R(rd) = ror(src1, src2));
+  INSTPAT("0110000 ????? ????? 101 ????? 00100 11", rori  , I, R(rd) = ror(src1, imm));
+  INSTPAT("0010100 00111 ????? 101 ????? 00100 11", orc_b , R, R(rd) = orc_b(src1));
+  INSTPAT("0110100 11000 ????? 101 ????? 00100 11", rev8  , R, R(rd) = __builtin_bswap32(src1));
+#endif
+
+  // A extension, aq and rl are covered by the sequentially consistent host atomics
+  INSTPAT("00010 ?? 00000 ????? 010 ????? 01011 11", lr_w     , R, R(rd) = lr(s, src1));
+  INSTPAT("00011 ?? ????? ????? 010 ????? 01011 11", sc_w     , R, R(rd) = sc(s, src1, src2));
+  INSTPAT("00001 ?? ????? ????? 010 ????? 01011 11", amoswap_w, R, R(rd) = amo(s, src1, AMO_SWAP, src2));
+  INSTPAT("00000 ?? ????? ????? 010 ????? 01011 11", amoadd_w , R, R(rd) = amo(s, src1, AMO_ADD , src2));
+  INSTPAT("00100 ?? ????? ????? 010 ????? 01011 11", amoxor_w , R, R(rd) = amo(s, src1, AMO_XOR , src2));
+  INSTPAT("01100 ?? ????? ????? 010 ????? 01011 11", amoand_w , R, R(rd) = amo(s, src1, AMO_AND , src2));
+  INSTPAT("01000 ?? ????? ????? 010 ????? 01011 11", amoor_w  , R, R(rd) = amo(s, src1, AMO_OR  , src2));
+  INSTPAT("10000 ?? ????? ????? 010 ????? 01011 11", amomin_w , R, R(rd) = amo(s, src1, AMO_MIN , src2));
+  INSTPAT("10100 ?? ????? ????? 010 ????? 01011 11", amomax_w , R, R(rd) = amo(s, src1, AMO_MAX , src2));
+  INSTPAT("11000 ?? ????? ????? 010 ????? 01011 11", amominu_w, R, R(rd) = amo(s, src1, AMO_MINU, src2));
+  INSTPAT("11100 ?? ????? ????? 010 ????? 01011 11", amomaxu_w, R, R(rd) = amo(s, src1, AMO_MAXU, src2));
+
+  INSTPAT("??????? ????? ????? 001 ????? 11100 11", csrrw , I, R(rd) = csr_op(s, CSR_W, src1, true));
+  INSTPAT("??????? ????? ????? 010 ????? 11100 11", csrrs , I, R(rd) = csr_op(s, CSR_S, src1, BITS(s->isa.expanded, 19, 15) != 0));
+  INSTPAT("??????? ????? ????? 011 ????? 11100 11", csrrc , I, R(rd) = csr_op(s, CSR_C, src1, BITS(s->isa.expanded, 19, 15) != 0));
+  INSTPAT("??????? ????? ????? 101 ????? 11100 11", csrrwi, I, R(rd) = csr_op(s, CSR_W, BITS(s->isa.expanded, 19, 15), true));
+  INSTPAT("??????? ????? ????? 110 ????? 11100 11", csrrsi, I, R(rd) = csr_op(s, CSR_S, BITS(s->isa.expanded, 19, 15), BITS(s->isa.expanded, 19, 15) != 0));
+  INSTPAT("??????? ????? ????? 111 ????? 11100 11", csrrci, I, R(rd) = csr_op(s, CSR_C, BITS(s->isa.expanded, 19, 15), BITS(s->isa.expanded, 19, 15) != 0));
+  INSTPAT("0000000 00000 00000 000 00000 11100 11", ecall , N, s->dnpc = isa_raise_intr(EXC_ECALL_M, s->pc));
+  INSTPAT("0011000 00010 00000 000 00000 11100 11", mret  , N, s->dnpc = isa_mret());
+  INSTPAT("0001001 ????? ????? 000 00000 11100 11", sfence_vma, N, mmu_flush());
+  // custom-0: a hostcall with the id in imm, the arguments in a0-a2, the result in a0
+  INSTPAT("??????? ????? 00000 000 00000 00010 11", hostcall, I,
+      MUXDEF(CONFIG_HOSTCALL, R(10) = hostcall(s->pc, imm, R(10), R(11), R(12)), INV(s->pc)));
   INSTPAT("0000000 00001 00000 000 00000 11100 11", ebreak, N, NEMUTRAP(s->pc, R(10))); // R(10) is $a0
+  // time can pass if no interrupt can wake up the hart now
+  // only hart 0 owns the events
+  INSTPAT("0001000 00101 00000 000 00000 11100 11", wfi, N, IFDEF(CONFIG_TIMER_SKIP_IDLE,
+        if (cpu.mhartid == 0 && !(__atomic_load_n(&cpu.mip, __ATOMIC_ACQUIRE) & cpu.mie)) event_skip_idle()));
   INSTPAT("??????? ????? ????? ??? ????? ????? ??", inv, N, INV(s->pc));
 
   INSTPAT_END();
@@ -287,8 +565,173 @@ static int decode_exec(Decode *s)
   return 0;
 }
 
-int isa_exec_once(Decode *s)
+#ifdef CONFIG_INST_FUSION
+// Macro-op fusion: on a hit, a pair of instructions often emitted together
+// is executed at once. It still counts as two instructions, and it is not
+// done when the caller allows only one, so single-stepping stays exact.
+enum { FUSE_NONE, FUSE_LI, FUSE_LA, FUSE_CALL, FUSE_ZEXT, FUSE_CMP_BR };
+
+// Called at a miss after the instruction is fetched. The next instruction
+// is only peeked, it is fetched and compared again at every fused execution.
+static void fuse_check(Decode *s, DecodeCache *dc) {
+  dc->fuse = FUSE_NONE;
+  vaddr_t pc2 = s->snpc;
+  if (BREAKPOINT_HIT(pc2)) return;
+  if (isa_mmu_check(pc2, 4, MEM_TYPE_IFETCH) != MMU_DIRECT) return;
+  uint8_t *p = paddr_to_host(pc2, 2);
+  if (p == NULL) return;
+  uint32_t inst2 = host_read(p, 2);
+  int ilen2 = 2;
+  if ((inst2 & 0x3) == 0x3) {
+    if ((p = paddr_to_host(pc2, 4)) == NULL) return;
+    inst2 = host_read(p, 4);
+    ilen2 = 4;
+  }
+  uint32_t a = dc->expanded, b = (ilen2 == 4 ? inst2 : rvc_expand(inst2));
+  if (b == 0) return;
+
+  int op1 = BITS(a, 6, 0), f3 = BITS(a, 14, 12), rd = BITS(a, 11, 7);
+  int op2 = BITS(b, 6, 0), f3b = BITS(b, 14, 12), rdb = BITS(b, 11, 7);
+  int rs1b = BITS(b, 19, 15), rs2b = BITS(b, 24, 20);
+  word_t hi = a & ~(word_t)0xfff, lo = SEXT(BITS(b, 31, 20), 12);
+  bool addi_rd = (op2 == 0x13 && f3b == 0 && rdb == rd && rs1b == rd);
+  if (rd == 0) return;
+
+  if (op1 == 0x37 && addi_rd) {                    // lui + addi
+    dc->fuse = FUSE_LI; dc->f_imm = hi + lo;
+  } else if (op1 == 0x17 && addi_rd) {             // auipc + addi
+    dc->fuse = FUSE_LA; dc->f_imm = hi + lo;
+  } else if (op1 == 0x17 && op2 == 0x67 && f3b == 0 && rs1b == rd) { // auipc + jalr
+    dc->fuse = FUSE_CALL; dc->f_imm = hi; dc->f_imm2 = lo; dc->f_rd2 = rdb;
+  } else if (op1 == 0x13 && f3 == 1 && BITS(a, 31, 25) == 0 &&        // slli + srli
+      op2 == 0x13 && f3b == 5 && BITS(b, 31, 25) == 0 && rdb == rd && rs1b == rd) {
+    dc->fuse = FUSE_ZEXT; dc->f_rs1 = BITS(a, 19, 15);
+    dc->f_imm = BITS(a, 24, 20); dc->f_imm2 = BITS(b, 24, 20);
+  } else if (((op1 == 0x33 && BITS(a, 31, 25) == 0) || op1 == 0x13) && // slt[i][u] + beqz/bnez
+      (f3 == 2 || f3 == 3) && op2 == 0x63 && (f3b == 0 || f3b == 1) &&
+      ((rs1b == rd && rs2b == 0) || (rs1b == 0 && rs2b == rd))) {
+    dc->fuse = FUSE_CMP_BR;
+    dc->f_rs1 = BITS(a, 19, 15); dc->f_rs2 = BITS(a, 24, 20);
+    dc->f_cmp_imm = (op1 == 0x13); dc->f_imm = SEXT(BITS(a, 31, 20), 12);
+    dc->f_unsigned = (f3 == 3); dc->f_bne = (f3b == 1);
+    dc->f_imm2 = SEXT(((BITS(b, 31, 31) << 12) | (BITS(b, 7, 7) << 11) |
+          (BITS(b, 30, 25) << 5) | (BITS(b, 11, 8) << 1)), 13);
+  } else {
+    return;
+  }
+  dc->f_rd = rd;
+  dc->inst2 = inst2;
+  dc->ilen2 = ilen2;
+}
+
+static bool exec_fused(Decode *s, DecodeCache *dc) {
+  vaddr_t pc2 = s->snpc;
+  if (unlikely(inst_fetch(&s->snpc, dc->ilen2) != dc->inst2)) {
+    dc->fuse = FUSE_NONE;
+    s->snpc = pc2;
+    return false;
+  }
+  s->dnpc = s->snpc;
+  switch (dc->fuse) {
+    case FUSE_LI: R(dc->f_rd) = dc->f_imm; break;
+    case FUSE_LA: R(dc->f_rd) = s->pc + dc->f_imm; break;
+    case FUSE_CALL: {
+      word_t base = s->pc + dc->f_imm;
+      R(dc->f_rd) = base;
+      R(dc->f_rd2) = s->snpc;
+      s->dnpc = (base + dc->f_imm2) & ~(word_t)1;
+      break;
+    }
+    case FUSE_ZEXT: R(dc->f_rd) = (R(dc->f_rs1) << dc->f_imm) >> dc->f_imm2; break;
+    case FUSE_CMP_BR: {
+      word_t src1 = R(dc->f_rs1), src2 = (dc->f_cmp_imm ? dc->f_imm : R(dc->f_rs2));
+      bool c = (dc->f_unsigned ? src1 < src2 : (sword_t)src1 < (sword_t)src2);
+      R(dc->f_rd) = c;
+      if (c == dc->f_bne) s->dnpc = pc2 + dc->f_imm2;
+      break;
+    }
+    default: panic("bad fuse = %d", dc->fuse);
+  }
+  R(0) = 0;
+  return true;
+}
+#endif
+
+void isa_decode_flush() {
+  IFDEF(CONFIG_DECODE_CACHE, memset(dcache, 0, sizeof(dcache)));
+}
+
+static int exec_inst(Decode *s)
 {
-  s->isa.inst = inst_fetch(&s->snpc, 4);
-  return decode_exec(s);
+#ifdef CONFIG_DECODE_CACHE
+  DecodeCache *dc = &dcache[(s->pc >> 1) % DCACHE_SIZE];
+  if (likely(dc->pc == s->pc && dc->hit != NULL)) {
+    int ilen = ((dc->inst & 0x3) == 0x3 ? 4 : 2);
+    s->isa.inst = inst_fetch(&s->snpc, ilen);
+    if (likely(s->isa.inst == dc->inst)) {
+      s->isa.expanded = dc->expanded;
+      IFDEF(CONFIG_INST_FUSION, if (dc->fuse != FUSE_NONE && s->can_fuse && exec_fused(s, dc)) return 1);
+      return decode_exec(s, dc);
+    }
+    s->snpc = s->pc;
+  }
+  dc->pc = s->pc;
+  dc->hit = NULL;
+#else
+  DecodeCache *dc = NULL;
+#endif
+  // stop before the instruction, which is not cached so that it is checked again
+  if (BREAKPOINT_HIT(s->pc)) { s->dnpc = s->pc; return -1; }
+
+  s->isa.inst = inst_fetch(&s->snpc, 2);
+  if ((s->isa.inst & 0x3) == 0x3) {
+    s->isa.inst |= inst_fetch(&s->snpc, 2) << 16;
+    s->isa.expanded = s->isa.inst;
+  } else {
+    s->isa.expanded = rvc_expand(s->isa.inst);
+  }
+  IFDEF(CONFIG_DECODE_CACHE, dc->inst = s->isa.inst; dc->expanded = s->isa.expanded);
+  IFDEF(CONFIG_INST_FUSION, fuse_check(s, dc));
+  return decode_exec(s, dc);
+}
+
+#ifdef CONFIG_RV_SV32
+// A page fault cancels the instruction, it jumps back from the access to
+// exec_paged() and traps there. The jump is only set up while translating.
+static HART_LOCAL jmp_buf *fault_jmp = NULL;
+
+void isa_mmu_fault(vaddr_t vaddr, int type) {
+  if (fault_jmp == NULL) return;
+  static const int cause[] = { [MEM_TYPE_IFETCH] = EXC_IPF, [MEM_TYPE_READ] = EXC_LPF, [MEM_TYPE_WRITE] = EXC_SPF };
+  cpu.mtval = vaddr;
+  longjmp(*fault_jmp, cause[type]);
+}
+
+static int exec_paged(Decode *s) {
+  jmp_buf buf;
+  int cause = setjmp(buf);
+  if (cause != 0) {
+    fault_jmp = NULL;
+    s->dnpc = isa_raise_intr(cause, s->pc);
+    return 0;
+  }
+  fault_jmp = &buf;
+  // the second instruction of a pair may fault after the first is done
+  IFDEF(CONFIG_INST_FUSION, s->can_fuse = false);
+  int ret = exec_inst(s);
+  fault_jmp = NULL;
+  return ret;
+}
+#else
+void isa_mmu_fault(vaddr_t vaddr, int type) {
+}
+#endif
+
+// return the number of the instructions executed besides the one at s->pc,
+// -1 if it is not executed because of a breakpoint
+int isa_exec_once(Decode *s) {
+#ifdef CONFIG_RV_SV32
+  if (unlikely(isa_mmu_check(s->pc, 4, MEM_TYPE_IFETCH) != MMU_DIRECT)) return exec_paged(s);
+#endif
+  return exec_inst(s);
 }
@@ -30,4 +30,32 @@ static inline const char* reg_name(int idx) {
   return regs[check_reg_idx(idx)];
 }
 
+enum {
+  CSR_SATP = 0x180,
+  CSR_MSTATUS = 0x300, CSR_MISA = 0x301, CSR_MIE = 0x304, CSR_MTVEC = 0x305,
+  CSR_MSCRATCH = 0x340, CSR_MEPC = 0x341, CSR_MCAUSE = 0x342, CSR_MTVAL = 0x343, CSR_MIP = 0x344,
+  CSR_MVENDORID = 0xf11, CSR_MARCHID = 0xf12, CSR_MIMPID = 0xf13, CSR_MHARTID = 0xf14,
+};
+
+#define MSTATUS_MIE  (1u << 3)
+#define MSTATUS_MPIE (1u << 7)
+#define MSTATUS_MPP  (3u << 11)
+#define MSTATUS_MPRV (1u << 17)
+
+enum { IRQ_MSI = 3, IRQ_MTI = 7, IRQ_MEI = 11 };
+#define MIP_MSIP (1u << IRQ_MSI)
+#define MIP_MTIP (1u << IRQ_MTI)
+#define MIP_MEIP (1u << IRQ_MEI)
+#define INTR_BIT ((word_t)1 << (sizeof(word_t) * 8 - 1))
+
+enum { EXC_II = 2, EXC_BP = 3, EXC_ECALL_M = 11, EXC_IPF = 12, EXC_LPF = 13, EXC_SPF = 15 };
+
+// return false for an illegal access
+bool csr_read(uint32_t addr, word_t *val);
+bool csr_write(uint32_t addr, word_t val);
+vaddr_t isa_mret();
+void intr_update();
+// flush the page-walk cache
+void mmu_flush();
+
 #endif
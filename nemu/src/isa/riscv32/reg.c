@@ -39,6 +39,26 @@ void isa_reg_display() {
 // regs[] 数组应该已经在这个文件或者它包含的头文件里定义好了
 // static const char *regs[] = { ... };
 
+// x0-x31, pc, f0-f31, then the CSRs from 65
+#define GDB_REG_PC 32
+#define GDB_REG_CSR 65
+
+bool isa_gdb_reg_read(int i, word_t *val) {
+  if (i < 32) *val = cpu.gpr[i];
+  else if (i == GDB_REG_PC) *val = cpu.pc;
+  else if (i >= GDB_REG_CSR) return csr_read(i - GDB_REG_CSR, val);
+  else return false;
+  return true;
+}
+
+bool isa_gdb_reg_write(int i, word_t val) {
+  if (i < 32) { if (i != 0) cpu.gpr[i] = val; }
+  else if (i == GDB_REG_PC) cpu.pc = val;
+  else if (i >= GDB_REG_CSR) return csr_write(i - GDB_REG_CSR, val);
+  else return false;
+  return true;
+}
+
 word_t isa_reg_str2val(const char *s, bool *success) {
   // 默认设置为成功
   *success = true;
@@ -0,0 +1,68 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include "../local-include/reg.h"
+
+#define MISA_EXT(c) (1u << ((c) - 'A'))
+#define MISA (MUXDEF(CONFIG_RV64, 2ull << 62, 1u << 30) | MISA_EXT('I') | MISA_EXT('M') | \
+    MISA_EXT('A') | MISA_EXT('C'))
+
+bool csr_read(uint32_t addr, word_t *val) {
+  switch (addr) {
+    case CSR_SATP:     *val = cpu.satp; break;
+    case CSR_MSTATUS:  *val = cpu.mstatus; break;
+    case CSR_MISA:     *val = MISA; break;
+    case CSR_MIE:      *val = cpu.mie; break;
+    case CSR_MTVEC:    *val = cpu.mtvec; break;
+    case CSR_MSCRATCH: *val = cpu.mscratch; break;
+    case CSR_MEPC:     *val = cpu.mepc; break;
+    case CSR_MCAUSE:   *val = cpu.mcause; break;
+    case CSR_MTVAL:    *val = cpu.mtval; break;
+    case CSR_MIP:      *val = __atomic_load_n(&cpu.mip, __ATOMIC_ACQUIRE); break;
+    case CSR_MVENDORID: case CSR_MARCHID: case CSR_MIMPID: *val = 0; break;
+    case CSR_MHARTID:  *val = cpu.mhartid; break;
+    default: return false;
+  }
+  return true;
+}
+
+bool csr_write(uint32_t addr, word_t val) {
+  // CSRs in 0xc00-0xfff are read-only
+  if (BITS(addr, 11, 10) == 3) return false;
+  switch (addr) {
+    // MODE and PPN, ASID is not supported
+    case CSR_SATP:
+      cpu.satp = MUXDEF(CONFIG_RV_SV32, val & ~((word_t)BITMASK(9) << 22), 0);
+      mmu_flush();
+      break;
+    // only machine mode, so MPP is always M
+    case CSR_MSTATUS:  cpu.mstatus = (val & (MSTATUS_MIE | MSTATUS_MPIE | MSTATUS_MPRV)) | MSTATUS_MPP; break;
+    case CSR_MISA:     break;
+    case CSR_MIE:      cpu.mie = val & (MIP_MSIP | MIP_MTIP | MIP_MEIP); break;
+    // mode 2 and 3 are reserved
+    case CSR_MTVEC:    cpu.mtvec = val & ~(word_t)2; break;
+    case CSR_MSCRATCH: cpu.mscratch = val; break;
+    case CSR_MEPC:     cpu.mepc = val & ~(word_t)1; break;
+    case CSR_MCAUSE:   cpu.mcause = val; break;
+    case CSR_MTVAL:    cpu.mtval = val; break;
+    // the pending bits are driven by the devices
+    case CSR_MIP:      break;
+    default: return false;
+  }
+  // an interrupt may have been enabled
+  if (addr == CSR_MSTATUS || addr == CSR_MIE) intr_update();
+  return true;
+}
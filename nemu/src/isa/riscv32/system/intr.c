@@ -14,15 +14,53 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <device/event.h>
+#include "../local-include/reg.h"
 
 word_t isa_raise_intr(word_t NO, vaddr_t epc) {
-  /* TODO: Trigger an interrupt/exception with ``NO''.
-   * Then return the address of the interrupt/exception vector.
-   */
+  cpu.mepc = epc;
+  cpu.mcause = NO;
+  word_t mie = (cpu.mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0;
+  cpu.mstatus = (cpu.mstatus & ~(MSTATUS_MIE | MSTATUS_MPIE)) | mie | MSTATUS_MPP;
 
-  return 0;
+  vaddr_t base = cpu.mtvec & ~(word_t)3;
+  if ((cpu.mtvec & 1) && (NO & INTR_BIT)) return base + 4 * (NO & ~INTR_BIT);
+  return base;
+}
+
+vaddr_t isa_mret() {
+  word_t mie = (cpu.mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0;
+  cpu.mstatus = (cpu.mstatus & ~MSTATUS_MIE) | mie | MSTATUS_MPIE | MSTATUS_MPP;
+  intr_update();
+  return cpu.mepc;
 }
 
 word_t isa_query_intr() {
+  if (!(cpu.mstatus & MSTATUS_MIE)) return INTR_EMPTY;
+  word_t pending = __atomic_load_n(&cpu.mip, __ATOMIC_ACQUIRE) & cpu.mie;
+  if (likely(pending == 0)) return INTR_EMPTY;
+  static const int prio[] = { IRQ_MEI, IRQ_MSI, IRQ_MTI };
+  for (int i = 0; i < ARRLEN(prio); i ++) {
+    if (pending & (1u << prio[i])) {
+      // there is no mtimecmp to clear it, so the timer interrupt is an edge
+      if (prio[i] == IRQ_MTI) __atomic_fetch_and(&cpu.mip, ~MIP_MTIP, __ATOMIC_ACQ_REL);
+      return INTR_BIT | prio[i];
+    }
+  }
   return INTR_EMPTY;
 }
+
+// called by the timer on hart 0
+void isa_pend_intr() {
+  __atomic_fetch_or(&cpu.mip, MIP_MTIP, __ATOMIC_RELEASE);
+}
+
+// Interrupts are only checked together with the events, so ask for a check
+// after the guest enables an interrupt which is already pending.
+void intr_update() {
+#ifdef CONFIG_DEVICE
+  if ((cpu.mstatus & MSTATUS_MIE) && (__atomic_load_n(&cpu.mip, __ATOMIC_ACQUIRE) & cpu.mie)) {
+    event_kick();
+  }
+#endif
+}
@@ -16,7 +16,103 @@
 #include <isa.h>
 #include <memory/vaddr.h>
 #include <memory/paddr.h>
+#include "../local-include/reg.h"
 
+#ifdef CONFIG_RV_SV32
+#define PTE_V 0x01
+#define PTE_R 0x02
+#define PTE_W 0x04
+#define PTE_X 0x08
+#define PTE_U 0x10
+#define PTE_A 0x40
+#define PTE_D 0x80
+#define PTE_PPN(pte) ((paddr_t)BITS(pte, 31, 10) << PAGE_SHIFT)
+
+// Page-walk cache of the level-1 PTEs. A walk hitting it reads only the
+// leaf PTE, or nothing for a 4 MB superpage. Since there is no ASID, it is
+// flushed at the write of satp and at sfence.vma.
+#define PWC_SIZE 64
+
+typedef struct {
+  bool valid;
+  uint32_t vpn1;
+  word_t pte;
+  paddr_t pte_addr; // to update the A/D bits of a superpage
+} PWCEntry;
+
+static HART_LOCAL PWCEntry pwc[PWC_SIZE];
+static HART_LOCAL uint64_t nr_walk = 0, nr_pwc_miss = 0;
+
+void mmu_flush() {
+  memset(pwc, 0, sizeof(pwc));
+}
+
+// check the permission of a leaf PTE and update its A/D bits unless probing
+static paddr_t leaf(paddr_t pte_addr, word_t *pte, int type, paddr_t page, bool probe) {
+  static const word_t perm[] = { [MEM_TYPE_IFETCH] = PTE_X, [MEM_TYPE_READ] = PTE_R, [MEM_TYPE_WRITE] = PTE_W };
+  if (!(*pte & perm[type])) return MEM_RET_FAIL;
+  word_t ad = PTE_A | (type == MEM_TYPE_WRITE ? PTE_D : 0);
+  if (!probe && (*pte & ad) != ad) {
+    *pte |= ad;
+    paddr_write(pte_addr, 4, *pte);
+  }
+  return page | MEM_RET_OK;
+}
+
+// A probe leaves no trace: no A/D bits, no PWC refill and no statistic.
+static paddr_t walk(vaddr_t vaddr, int type, bool probe) {
+  uint32_t vpn1 = BITS(vaddr, 31, 22);
+  // fold the high bits, the regions of user and kernel are usually aligned
+  PWCEntry *e = &pwc[(vpn1 ^ (vpn1 >> 6)) % PWC_SIZE];
+  PWCEntry tmp;
+  if (unlikely(!e->valid || e->vpn1 != vpn1)) {
+    if (!probe) nr_pwc_miss ++;
+    paddr_t pte_addr = ((paddr_t)BITS(cpu.satp, 21, 0) << PAGE_SHIFT) + vpn1 * 4;
+    word_t pte = paddr_read(pte_addr, 4);
+    // W without R is reserved
+    if (!(pte & PTE_V) || (pte & (PTE_R | PTE_W)) == PTE_W) return MEM_RET_FAIL;
+    // a superpage must be aligned
+    if ((pte & (PTE_R | PTE_X)) && BITS(pte, 19, 10) != 0) return MEM_RET_FAIL;
+    // A, D and U are reserved in a non-leaf PTE
+    if (!(pte & (PTE_R | PTE_X)) && (pte & (PTE_A | PTE_D | PTE_U))) return MEM_RET_FAIL;
+    if (probe) e = &tmp;
+    *e = (PWCEntry) { .valid = true, .vpn1 = vpn1, .pte = pte, .pte_addr = pte_addr };
+  }
+  if (e->pte & (PTE_R | PTE_X)) return leaf(e->pte_addr, &e->pte, type, PTE_PPN(e->pte) | (vaddr & 0x3ff000), probe);
+
+  paddr_t pte_addr = PTE_PPN(e->pte) + BITS(vaddr, 21, 12) * 4;
+  word_t pte = paddr_read(pte_addr, 4);
+  if (!(pte & PTE_V) || !(pte & (PTE_R | PTE_X)) || (pte & (PTE_R | PTE_W)) == PTE_W) return MEM_RET_FAIL;
+  return leaf(pte_addr, &pte, type, PTE_PPN(pte), probe);
+}
+
+// There is no S-mode, so the translation is on whenever satp.MODE is Sv32,
+// see isa_mmu_check(). Return the physical page of vaddr or MEM_RET_FAIL.
+paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
+  nr_walk ++;
+  return walk(vaddr, type, false);
+}
+
+paddr_t isa_mmu_probe(vaddr_t vaddr, int len, int type) {
+  return walk(vaddr, type, true);
+}
+
+void isa_mmu_statistic() {
+  if (nr_walk == 0) return;
+  Log("page walks = %" PRIu64 ", page-walk cache misses = %" PRIu64, nr_walk, nr_pwc_miss);
+}
+#else
 paddr_t isa_mmu_translate(vaddr_t vaddr, int len, int type) {
   return MEM_RET_FAIL;
 }
+
+paddr_t isa_mmu_probe(vaddr_t vaddr, int len, int type) {
+  return MEM_RET_FAIL;
+}
+
+void mmu_flush() {
+}
+
+void isa_mmu_statistic() {
+}
+#endif
@@ -17,6 +17,7 @@
 #include <cpu/cpu.h>
 #include <cpu/ifetch.h>
 #include <cpu/decode.h>
+#include <memory/paddr.h>
 
 typedef union {
   struct {
@@ -40,8 +41,9 @@ typedef union {
   uint8_t val;
 } SIB;
 
+// the decode cache also needs the bytes to check them next time
 static word_t x86_inst_fetch(Decode *s, int len) {
-#if defined(CONFIG_ITRACE) || defined(CONFIG_IQUEUE)
+#if defined(CONFIG_ITRACE) || defined(CONFIG_IQUEUE) || defined(CONFIG_DECODE_CACHE)
   uint8_t *p = &s->isa.inst[s->snpc - s->pc];
   word_t ret = inst_fetch(&s->snpc, len);
   word_t ret_save = ret;
@@ -75,7 +77,22 @@ static void reg_write(int idx, int width, word_t data) {
   }
 }
 
-static void load_addr(Decode *s, ModR_M *m, word_t *rm_addr) {
+// Everything decoded from the instruction bytes. The memory operand is
+// kept as a recipe, since the registers it uses change between executions.
+typedef struct {
+  int8_t rd, rs, gp_idx;
+  int8_t base, index, scale; // addr = disp + base + (index << scale), -1 for none
+  word_t disp, imm;
+} Operand;
+
+static inline word_t ea(Operand *op) {
+  word_t addr = op->disp;
+  if (op->base != -1)  addr += reg_l(op->base);
+  if (op->index != -1) addr += reg_l(op->index) << op->scale;
+  return addr;
+}
+
+static void load_addr(Decode *s, ModR_M *m, Operand *op) {
   assert(m->mod != 3);
 
   sword_t disp = 0;
@@ -103,18 +120,18 @@ static void load_addr(Decode *s, ModR_M *m, word_t *rm_addr) {
     if (disp_size == 1) { disp = (int8_t)disp; }
   }
 
-  word_t addr = disp;
-  if (base_reg != -1)  addr += reg_l(base_reg);
-  if (index_reg != -1) addr += reg_l(index_reg) << scale;
-  *rm_addr = addr;
+  op->disp = disp;
+  op->base = base_reg;
+  op->index = index_reg;
+  op->scale = scale;
 }
 
-static void decode_rm(Decode *s, int *rm_reg, word_t *rm_addr, int *reg, int width) {
+static void decode_rm(Decode *s, int8_t *rm_reg, Operand *op, int8_t *reg, int width) {
   ModR_M m;
   m.val = x86_inst_fetch(s, 1);
   if (reg != NULL) *reg = m.reg;
   if (m.mod == 3) *rm_reg = m.R_M;
-  else { load_addr(s, &m, rm_addr); *rm_reg = -1; }
+  else { load_addr(s, &m, op); *rm_reg = -1; }
 }
 
 #define Rr reg_read
@@ -124,10 +141,9 @@ static void decode_rm(Decode *s, int *rm_reg, word_t *rm_addr, int *reg, int wid
 #define RMr(reg, w)  (reg != -1 ? Rr(reg, w) : Mr(addr, w))
 #define RMw(data) do { if (rd != -1) Rw(rd, w, data); else Mw(addr, w, data); } while (0)
 
-#define destr(r)  do { *rd_ = (r); } while (0)
-#define src1r(r)  do { *src1 = Rr(r, w); } while (0)
-#define imm()     do { *imm = x86_inst_fetch(s, w); } while (0)
-#define simm(w)   do { *imm = SEXT(x86_inst_fetch(s, w), w * 8); } while (0)
+#define destr(r)  do { op->rd = (r); } while (0)
+#define imm()     do { op->imm = x86_inst_fetch(s, w); } while (0)
+#define simm(w)   do { op->imm = SEXT(x86_inst_fetch(s, w), w * 8); } while (0)
 
 enum {
   TYPE_r, TYPE_I, TYPE_SI, TYPE_J, TYPE_E,
@@ -146,25 +162,70 @@ enum {
   TYPE_N, // none
 };
 
+#ifdef CONFIG_DECODE_CACHE
+// Direct-mapped on pc. The instruction bytes are compared with the memory at
+// every hit, so a write to the code makes the entry miss.
+#define DCACHE_SIZE 4096
+
+typedef struct {
+  vaddr_t pc;
+  int len;
+  uint8_t inst[16];
+  uint8_t opcode, opcode2; // the one-byte and the escaped opcode
+  bool is_operand_size_16;
+  Operand op;
+  const void *hit, *hit2;  // the matched patterns in isa_exec_once() and _2byte_esc()
+} DecodeCache;
+
+static DecodeCache dcache[DCACHE_SIZE] = {};
+
+#define INSTPAT_HIT(s, label) (*dc_hit = (label))
+
+static bool dcache_lookup(Decode *s, DecodeCache *dc) {
+  if (likely(dc->pc == s->pc && dc->hit != NULL)) {
+    // compare with the memory directly, fetching the bytes again costs as much as decoding
+    uint8_t *p = (isa_mmu_check(s->pc, dc->len, MEM_TYPE_IFETCH) == MMU_DIRECT ?
+        paddr_to_host(s->pc, dc->len) : NULL);
+    if (likely(p != NULL && memcmp(p, dc->inst, dc->len) == 0)) {
+      memcpy(s->isa.inst, dc->inst, dc->len);
+      s->snpc = s->pc + dc->len;
+      return true;
+    }
+  }
+  dc->pc = s->pc;
+  dc->hit = dc->hit2 = NULL;
+  return false;
+}
+#else
+typedef struct {
+  uint8_t opcode, opcode2;
+  bool is_operand_size_16;
+  Operand op;
+} DecodeCache;
+#endif
+
+// The operands are only decoded at a miss. On a hit the pattern matching
+// is skipped and the operands come from the cache.
 #define INSTPAT_INST(s) opcode
 #define INSTPAT_MATCH(s, name, type, width, ... /* execute body */ ) { \
-  int rd = 0, rs = 0, gp_idx = 0; \
-  word_t src1 = 0, addr = 0, imm = 0; \
   int w = width == 0 ? (is_operand_size_16 ? 2 : 4) : width; \
-  decode_operand(s, opcode, &rd, &src1, &addr, &rs, &gp_idx, &imm, w, concat(TYPE_, type)); \
+  if (!cached) decode_operand(s, opcode, op, w, concat(TYPE_, type)); \
+  __attribute__((unused)) int rd = op->rd, rs = op->rs, gp_idx = op->gp_idx; \
+  __attribute__((unused)) word_t imm = op->imm, addr = ea(op); \
+  __attribute__((unused)) word_t src1 = (concat(TYPE_, type) == TYPE_G2E ? Rr(rs, w) : 0); \
   s->dnpc = s->snpc; \
   __VA_ARGS__ ; \
 }
 
-static void decode_operand(Decode *s, uint8_t opcode, int *rd_, word_t *src1,
-    word_t *addr, int *rs, int *gp_idx, word_t *imm, int w, int type) {
+static void decode_operand(Decode *s, uint8_t opcode, Operand *op, int w, int type) {
+  *op = (Operand) { .base = -1, .index = -1 };
   switch (type) {
     case TYPE_I2r:  destr(opcode & 0x7); imm(); break;
-    case TYPE_G2E:  decode_rm(s, rd_, addr, rs, w); src1r(*rs); break;
-    case TYPE_E2G:  decode_rm(s, rs, addr, rd_, w); break;
-    case TYPE_I2E:  decode_rm(s, rd_, addr, gp_idx, w); imm(); break;
-    case TYPE_O2a:  destr(R_EAX); *addr = x86_inst_fetch(s, 4); break;
-    case TYPE_a2O:  *rs = R_EAX;  *addr = x86_inst_fetch(s, 4); break;
+    case TYPE_G2E:  decode_rm(s, &op->rd, op, &op->rs, w); break;
+    case TYPE_E2G:  decode_rm(s, &op->rs, op, &op->rd, w); break;
+    case TYPE_I2E:  decode_rm(s, &op->rd, op, &op->gp_idx, w); imm(); break;
+    case TYPE_O2a:  destr(R_EAX); op->disp = x86_inst_fetch(s, 4); break;
+    case TYPE_a2O:  op->rs = R_EAX; op->disp = x86_inst_fetch(s, 4); break;
     case TYPE_N:    break;
     default: panic("Unsupported type = %d", type);
   }
@@ -176,9 +237,13 @@ static void decode_operand(Decode *s, uint8_t opcode, int *rd_, word_t *src1,
   }; \
 } while (0)
 
-void _2byte_esc(Decode *s, bool is_operand_size_16) {
-  uint8_t opcode = x86_inst_fetch(s, 1);
+static void _2byte_esc(Decode *s, DecodeCache *dc, bool cached, bool is_operand_size_16) {
+  Operand *op = &dc->op;
+  uint8_t opcode = (cached ? dc->opcode2 : x86_inst_fetch(s, 1));
+  dc->opcode2 = opcode;
+  IFDEF(CONFIG_DECODE_CACHE, const void **dc_hit = &dc->hit2);
   INSTPAT_START();
+  IFDEF(CONFIG_DECODE_CACHE, if (cached) goto *dc->hit2);
   INSTPAT("???? ????", inv,    N,    0, INV(s->pc));
   INSTPAT_END();
 }
@@ -186,13 +251,25 @@ void _2byte_esc(Decode *s, bool is_operand_size_16) {
 int isa_exec_once(Decode *s) {
   bool is_operand_size_16 = false;
   uint8_t opcode = 0;
+#ifdef CONFIG_DECODE_CACHE
+  DecodeCache *dc = &dcache[s->pc % DCACHE_SIZE];
+  bool cached = dcache_lookup(s, dc);
+  if (cached) { opcode = dc->opcode; is_operand_size_16 = dc->is_operand_size_16; }
+  const void **dc_hit = &dc->hit;
+#else
+  DecodeCache dc_local, *dc = &dc_local;
+  bool cached = false;
+#endif
+  Operand *op = &dc->op;
 
 again:
-  opcode = x86_inst_fetch(s, 1);
+  if (!cached) opcode = x86_inst_fetch(s, 1);
 
   INSTPAT_START();
+  // skip the matching and the decoding for an instruction seen before
+  IFDEF(CONFIG_DECODE_CACHE, if (cached) goto *dc->hit);
 
-  INSTPAT("0000 1111", 2byte_esc, N,    0, _2byte_esc(s, is_operand_size_16));
+  INSTPAT("0000 1111", 2byte_esc, N,    0, _2byte_esc(s, dc, cached, is_operand_size_16));
 
   INSTPAT("0110 0110", data_size, N,    0, is_operand_size_16 = true; goto again;);
 
@@ -216,5 +293,14 @@ again:
   INSTPAT("???? ????", inv,       N,    0, INV(s->pc));
   INSTPAT_END();
 
+#ifdef CONFIG_DECODE_CACHE
+  if (!cached) {
+    dc->len = s->snpc - s->pc;
+    memcpy(dc->inst, s->isa.inst, dc->len);
+    dc->opcode = opcode;
+    dc->is_operand_size_16 = is_operand_size_16;
+  }
+#endif
+
   return 0;
 }
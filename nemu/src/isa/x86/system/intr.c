@@ -26,3 +26,10 @@ word_t isa_raise_intr(word_t NO, vaddr_t ret_addr) {
 
 void query_intr() {
 }
+
+word_t isa_query_intr() {
+  return INTR_EMPTY;
+}
+
+void isa_pend_intr() {
+}
@@ -17,8 +17,13 @@
 #include <memory/paddr.h>
 #include <device/mmio.h>
 #include <isa.h>
+#include <cpu/difftest.h>
+#include <memory/vaddr.h>
+#ifndef CONFIG_TARGET_AM
+#include <sys/mman.h>
+#endif
 
-#if   defined(CONFIG_PMEM_MALLOC)
+#if   defined(CONFIG_PMEM_MALLOC) || defined(CONFIG_PMEM_MMAP)
 static uint8_t *pmem = NULL;
 #else // CONFIG_PMEM_GARRAY
 static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
@@ -27,15 +32,89 @@ static uint8_t pmem[CONFIG_MSIZE] PG_ALIGN = {};
 uint8_t* guest_to_host(paddr_t paddr) { return pmem + paddr - CONFIG_MBASE; }
 paddr_t host_to_guest(uint8_t *haddr) { return haddr - pmem + CONFIG_MBASE; }
 
-static word_t pmem_read(paddr_t addr, int len) {
-  word_t ret = host_read(guest_to_host(addr), len);
-  return ret;
+#ifdef CONFIG_PMEM_MMAP
+#include <signal.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define PMEM_MMAP_SIZE ROUNDUP(CONFIG_MSIZE, HUGE_PAGE_SIZE)
+
+#ifdef CONFIG_MEM_RANDOM
+// The memory is mapped without access at first. The first access to a
+// chunk, either from the guest or from NEMU itself (e.g. loading the
+// image), faults and the chunk is filled here.
+static uint8_t fill_byte = 0;
+static struct sigaction old_sa;
+
+static void pmem_fault_handler(int sig, siginfo_t *info, void *ucontext) {
+  uint8_t *addr = info->si_addr;
+  if (addr >= pmem && addr < pmem + PMEM_MMAP_SIZE) {
+    uint8_t *chunk = (uint8_t *)ROUNDDOWN(addr, HUGE_PAGE_SIZE); // pmem is aligned
+    if (mprotect(chunk, HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE) == 0) {
+      memset(chunk, fill_byte, HUGE_PAGE_SIZE);
+      return;
+    }
+  }
+  // not caused by pmem, crash as usual when the access is restarted
+  sigaction(SIGSEGV, &old_sa, NULL);
+}
+#endif
+
+static void init_pmem_mmap() {
+  // one more huge page to align the start
+  size_t size = PMEM_MMAP_SIZE + HUGE_PAGE_SIZE;
+  uint8_t *p = mmap(NULL, size, MUXDEF(CONFIG_MEM_RANDOM, PROT_NONE, PROT_READ | PROT_WRITE),
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  Assert(p != MAP_FAILED, "can not mmap() %zu bytes for pmem", size);
+  pmem = (uint8_t *)ROUNDUP(p, HUGE_PAGE_SIZE);
+  // it is fine if transparent huge pages are disabled on the host
+  madvise(pmem, PMEM_MMAP_SIZE, MADV_HUGEPAGE);
+
+#ifdef CONFIG_MEM_RANDOM
+  fill_byte = rand();
+  struct sigaction sa = {};
+  sa.sa_sigaction = pmem_fault_handler;
+  sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset(&sa.sa_mask);
+  int ret = sigaction(SIGSEGV, &sa, &old_sa);
+  Assert(ret == 0, "can not install the fault handler of pmem");
+#endif
 }
+#endif
 
-static void pmem_write(paddr_t addr, int len, word_t data) {
-  host_write(guest_to_host(addr), len, data);
+uint8_t* paddr_to_host(paddr_t paddr, size_t len) {
+  paddr_t last = paddr + (len > 0 ? len - 1 : 0);
+  if (in_pmem(paddr) && in_pmem(last) && last >= paddr) return guest_to_host(paddr);
+#ifdef CONFIG_MEM_REGIONS
+  MemRegion *r = find_mem_region(paddr);
+  if (r != NULL && last >= paddr && last - r->base < r->size) return r->space + (paddr - r->base);
+#endif
+  return NULL;
 }
 
+#ifndef CONFIG_TARGET_AM
+bool pmem_map_file(int fd, off_t offset, paddr_t paddr, size_t size) {
+  uint8_t *haddr = paddr_to_host(paddr, size);
+  if (size == 0 || haddr == NULL || (((uintptr_t)haddr | offset | size) & (PAGE_SIZE - 1))) return false;
+#if defined(CONFIG_PMEM_MMAP) && defined(CONFIG_MEM_RANDOM)
+  // fill the chunks partially covered by the file, the others are just replaced
+  if (in_pmem(paddr)) {
+    (void)*(volatile uint8_t *)haddr;
+    (void)*(volatile uint8_t *)(haddr + size - 1);
+  }
+#endif
+  void *p = mmap(haddr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset);
+  return p != MAP_FAILED;
+}
+#endif
+
+#ifdef CONFIG_MEM_REGIONS
+void init_mem_regions();
+
+static void read_only(MemRegion *r, paddr_t addr) {
+  panic("write to read-only %s at address = " FMT_PADDR " at pc = " FMT_WORD, r->name, addr, cpu.pc);
+}
+#endif
+
 static void out_of_bound(paddr_t addr) {
   panic("address = " FMT_PADDR " is out of bound of pmem [" FMT_PADDR ", " FMT_PADDR "] at pc = " FMT_WORD,
       addr, PMEM_LEFT, PMEM_RIGHT, cpu.pc);
@@ -45,14 +124,16 @@ void init_mem() {
 #if   defined(CONFIG_PMEM_MALLOC)
   pmem = malloc(CONFIG_MSIZE);
   assert(pmem);
+#elif defined(CONFIG_PMEM_MMAP)
+  init_pmem_mmap();
 #endif
-  IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE));
+  IFNDEF(CONFIG_PMEM_MMAP, IFDEF(CONFIG_MEM_RANDOM, memset(pmem, rand(), CONFIG_MSIZE)));
   Log("physical memory area [" FMT_PADDR ", " FMT_PADDR "]", PMEM_LEFT, PMEM_RIGHT);
+  IFDEF(CONFIG_MEM_REGIONS, init_mem_regions());
 }
 
-word_t paddr_read(paddr_t addr, int len) {
-    // 如果CONFIG_MTRACE被定义, 则添加mtrace逻辑
 #ifdef CONFIG_MTRACE
+static void mtrace_read(paddr_t addr, int len) {
   // 默认条件为true, 如果定义了MTRACE_COND, 则使用它
   bool condition = true;
   #ifdef CONFIG_MTRACE_COND
@@ -62,16 +143,9 @@ word_t paddr_read(paddr_t addr, int len) {
   if (condition) {
     Log("mtrace: read at address 0x%08x, len = %d", addr, len);
   }
-#endif
-  if (likely(in_pmem(addr))) return pmem_read(addr, len);
-  IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
-  out_of_bound(addr);
-  return 0;
 }
 
-void paddr_write(paddr_t addr, int len, word_t data) {
-    // --- MTRACE START ---
-#ifdef CONFIG_MTRACE
+static void mtrace_write(paddr_t addr, int len, word_t data) {
   // 同样的条件判断
   bool condition = true;
   #ifdef CONFIG_MTRACE_COND
@@ -81,8 +155,81 @@ void paddr_write(paddr_t addr, int len, word_t data) {
   if (condition) {
     Log("mtrace: write at address 0x%08x, len = %d, data = 0x%08x", addr, len, data);
   }
+}
+#endif
+
+// the whole access is in pmem, still a single comparison since len is a constant
+#define in_pmem_n(addr, len) ((paddr_t)((addr) - CONFIG_MBASE) <= CONFIG_MSIZE - (len))
+
+#ifdef CONFIG_MEM_REGIONS
+// the region of the whole access, an access crossing its end is out of bound
+static MemRegion *region_of(paddr_t addr, int len) {
+  MemRegion *r = find_mem_region(addr);
+  if (r != NULL && unlikely(addr + len - 1 - r->base >= r->size)) out_of_bound(addr);
+  return r;
+}
+#endif
+
+static word_t paddr_read_other(paddr_t addr, int len) {
+#ifdef CONFIG_MEM_REGIONS
+  MemRegion *r = region_of(addr, len);
+  if (r != NULL) return host_read(r->space + (addr - r->base), len);
+#endif
+  IFDEF(CONFIG_DEVICE, return mmio_read(addr, len));
+  out_of_bound(addr);
+  return 0;
+}
+
+static void paddr_write_other(paddr_t addr, int len, word_t data) {
+#ifdef CONFIG_MEM_REGIONS
+  MemRegion *r = region_of(addr, len);
+  if (r != NULL) {
+    if (unlikely(!r->writable)) read_only(r, addr);
+    host_write(r->space + (addr - r->base), len, data);
+    return;
+  }
 #endif
-  if (likely(in_pmem(addr))) { pmem_write(addr, len, data); return; }
   IFDEF(CONFIG_DEVICE, mmio_write(addr, len, data); return);
   out_of_bound(addr);
 }
+
+#define def_paddr_access(len) \
+  word_t concat(paddr_read_, len)(paddr_t addr) { \
+    IFDEF(CONFIG_MTRACE, mtrace_read(addr, len)); \
+    if (likely(in_pmem_n(addr, len))) return concat(host_read_, len)(guest_to_host(addr)); \
+    return paddr_read_other(addr, len); \
+  } \
+  void concat(paddr_write_, len)(paddr_t addr, word_t data) { \
+    IFDEF(CONFIG_MTRACE, mtrace_write(addr, len, data)); \
+    if (likely(in_pmem_n(addr, len))) { \
+      concat(host_write_, len)(guest_to_host(addr), data); \
+      IFDEF(CONFIG_DIFFTEST_ASYNC, difftest_commit_store(addr, len, data)); \
+      return; \
+    } \
+    paddr_write_other(addr, len, data); \
+  }
+
+def_paddr_access(1)
+def_paddr_access(2)
+def_paddr_access(4)
+IFDEF(CONFIG_ISA64, def_paddr_access(8))
+
+word_t paddr_read(paddr_t addr, int len) {
+  switch (len) {
+    case 1: return paddr_read_1(addr);
+    case 2: return paddr_read_2(addr);
+    case 4: return paddr_read_4(addr);
+    IFDEF(CONFIG_ISA64, case 8: return paddr_read_8(addr));
+    default: MUXDEF(CONFIG_RT_CHECK, assert(0), return 0);
+  }
+}
+
+void paddr_write(paddr_t addr, int len, word_t data) {
+  switch (len) {
+    case 1: paddr_write_1(addr, data); return;
+    case 2: paddr_write_2(addr, data); return;
+    case 4: paddr_write_4(addr, data); return;
+    IFDEF(CONFIG_ISA64, case 8: paddr_write_8(addr, data); return);
+    IFDEF(CONFIG_RT_CHECK, default: assert(0));
+  }
+}
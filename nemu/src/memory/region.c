@@ -0,0 +1,99 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef CONFIG_MEM_REGIONS
+
+// memory besides pmem, a region with size 0 is disabled
+static MemRegion regions[] = {
+  { "mrom",  CONFIG_MROM_BASE,  CONFIG_MROM_SIZE,  false, CONFIG_MROM_IMG  },
+  { "sram",  CONFIG_SRAM_BASE,  CONFIG_SRAM_SIZE,  true,  ""               },
+  { "flash", CONFIG_FLASH_BASE, CONFIG_FLASH_SIZE, false, CONFIG_FLASH_IMG },
+};
+static int nr_region = 0;
+// each hart has its own, since the harts run in parallel
+static HART_LOCAL MemRegion *last = regions;
+
+MemRegion* find_mem_region(paddr_t addr) {
+  // accesses usually stay in the same region for a while
+  if (likely(addr - last->base < last->size)) return last;
+  for (int i = 0; i < nr_region; i ++) {
+    if (addr - regions[i].base < regions[i].size) {
+      last = &regions[i];
+      return last;
+    }
+  }
+  return NULL;
+}
+
+MemRegion* find_mem_region_overlap(paddr_t left, paddr_t right) {
+  for (int i = 0; i < nr_region; i ++) {
+    if (left <= regions[i].base + regions[i].size - 1 && right >= regions[i].base) return &regions[i];
+  }
+  return NULL;
+}
+
+void foreach_mem_region(void (*f)(MemRegion *r)) {
+  for (int i = 0; i < nr_region; i ++) f(&regions[i]);
+}
+
+static void map_img(MemRegion *r) {
+  int fd = open(r->img, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s' for %s", r->img, r->name);
+  struct stat st;
+  int ret = fstat(fd, &st);
+  assert(ret == 0);
+  Assert(st.st_size <= r->size, "'%s' (%ld bytes) does not fit in %s",
+      r->img, (long)st.st_size, r->name);
+  // copy-on-write, so the file is never modified even if the region is writable
+  if (st.st_size > 0) {
+    void *p = mmap(r->space, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+    Assert(p != MAP_FAILED, "Can not mmap '%s' for %s", r->img, r->name);
+  }
+  close(fd);
+  Log("Map '%s' to %s, size = %ld", r->img, r->name, (long)st.st_size);
+}
+
+void init_mem_regions() {
+  for (int i = 0; i < ARRLEN(regions); i ++) {
+    MemRegion r = regions[i];
+    if (r.size == 0) continue;
+    paddr_t left = r.base, right = r.base + r.size - 1;
+    Assert(right >= left, "%s wraps around the address space", r.name);
+    Assert(!(left <= PMEM_RIGHT && right >= PMEM_LEFT), "%s@[" FMT_PADDR ", " FMT_PADDR "] "
+        "is overlapped with pmem", r.name, left, right);
+    for (int j = 0; j < nr_region; j ++) {
+      Assert(!(left <= regions[j].base + regions[j].size - 1 && right >= regions[j].base),
+          "%s is overlapped with %s", r.name, regions[j].name);
+    }
+
+    // page-aligned, so that a file can be mapped on it
+    r.space = mmap(NULL, ROUNDUP(r.size, PAGE_SIZE), PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    Assert(r.space != MAP_FAILED, "Can not allocate %s", r.name);
+    IFDEF(CONFIG_MEM_RANDOM, if (r.writable) memset(r.space, rand(), r.size));
+    regions[nr_region ++] = r;
+    Log("%s area [" FMT_PADDR ", " FMT_PADDR "]%s", r.name, left, right, r.writable ? "" : " (read-only)");
+    if (r.img[0] != '\0') map_img(&regions[nr_region - 1]);
+  }
+}
+#endif
@@ -14,16 +14,82 @@
 ***************************************************************************************/
 
 #include <isa.h>
+#include <cpu/cpu.h>
 #include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+bool vaddr_translate(vaddr_t addr, int len, int type, paddr_t *paddr) {
+  if (isa_mmu_check(addr, len, type) == MMU_DIRECT) { *paddr = addr; return true; }
+  paddr_t page = isa_mmu_translate(addr, len, type);
+  if ((page & PAGE_MASK) != MEM_RET_OK) return false;
+  *paddr = page | (addr & PAGE_MASK);
+  return true;
+}
+
+bool vaddr_probe(vaddr_t addr, int len, int type, paddr_t *paddr) {
+  if (isa_mmu_check(addr, len, type) == MMU_DIRECT) { *paddr = addr; return true; }
+  paddr_t page = isa_mmu_probe(addr, len, type);
+  if ((page & PAGE_MASK) != MEM_RET_OK) return false;
+  *paddr = page | (addr & PAGE_MASK);
+  return true;
+}
+
+// The slow path with translation. An access crossing a page is done by bytes.
+// A failed translation raises a page fault if the ISA can, otherwise it
+// stops NEMU like other bad accesses, and the access reads 0.
+static bool mmu_addr(vaddr_t addr, int len, int type, paddr_t *paddr) {
+  if (vaddr_translate(addr, len, type, paddr)) return true;
+  isa_mmu_fault(addr, type);
+  Log("page fault at vaddr = " FMT_WORD ", type = %d, pc = " FMT_WORD, addr, type, cpu.pc);
+  set_nemu_state(NEMU_ABORT, cpu.pc, -1);
+  return false;
+}
+
+static word_t mmu_read(vaddr_t addr, int len, int type) {
+  if (unlikely((addr & PAGE_MASK) + len > PAGE_SIZE)) {
+    word_t data = 0;
+    for (int i = 0; i < len; i ++) data |= mmu_read(addr + i, 1, type) << (i * 8);
+    return data;
+  }
+  paddr_t paddr = 0;
+  return (mmu_addr(addr, len, type, &paddr) ? paddr_read(paddr, len) : 0);
+}
+
+static void mmu_write(vaddr_t addr, int len, word_t data) {
+  if (unlikely((addr & PAGE_MASK) + len > PAGE_SIZE)) {
+    for (int i = 0; i < len; i ++) mmu_write(addr + i, 1, data >> (i * 8));
+    return;
+  }
+  paddr_t paddr = 0;
+  if (mmu_addr(addr, len, MEM_TYPE_WRITE, &paddr)) paddr_write(paddr, len, data);
+}
 
 word_t vaddr_ifetch(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  if (likely(isa_mmu_check(addr, len, MEM_TYPE_IFETCH) == MMU_DIRECT)) return paddr_read(addr, len);
+  return mmu_read(addr, len, MEM_TYPE_IFETCH);
 }
 
 word_t vaddr_read(vaddr_t addr, int len) {
-  return paddr_read(addr, len);
+  if (likely(isa_mmu_check(addr, len, MEM_TYPE_READ) == MMU_DIRECT)) return paddr_read(addr, len);
+  return mmu_read(addr, len, MEM_TYPE_READ);
 }
 
 void vaddr_write(vaddr_t addr, int len, word_t data) {
-  paddr_write(addr, len, data);
+  if (likely(isa_mmu_check(addr, len, MEM_TYPE_WRITE) == MMU_DIRECT)) paddr_write(addr, len, data);
+  else mmu_write(addr, len, data);
 }
+
+#define def_vaddr_access(len) \
+  word_t concat(vaddr_read_, len)(vaddr_t addr) { \
+    if (likely(isa_mmu_check(addr, len, MEM_TYPE_READ) == MMU_DIRECT)) return concat(paddr_read_, len)(addr); \
+    return mmu_read(addr, len, MEM_TYPE_READ); \
+  } \
+  void concat(vaddr_write_, len)(vaddr_t addr, word_t data) { \
+    if (likely(isa_mmu_check(addr, len, MEM_TYPE_WRITE) == MMU_DIRECT)) concat(paddr_write_, len)(addr, data); \
+    else mmu_write(addr, len, data); \
+  }
+
+def_vaddr_access(1)
+def_vaddr_access(2)
+def_vaddr_access(4)
+IFDEF(CONFIG_ISA64, def_vaddr_access(8))
@@ -0,0 +1,281 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+#include <isa.h>
+#include <cpu/cpu.h>
+#include <memory/paddr.h>
+#include <memory/vaddr.h>
+
+#ifdef CONFIG_GDB_STUB
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <unistd.h>
+
+/* A GDB remote serial protocol server, used instead of sdb with --gdb.
+ * The breakpoints are only checked by the ISA when an instruction is
+ * decoded from scratch, and an instruction at a breakpoint is never put
+ * into the decode cache, so the run is as fast as without gdb.
+ */
+
+#define MAX_BREAKPOINT 64
+#define PACKET_SIZE 4096
+// instructions between two checks for Ctrl-C from gdb
+#define RUN_CHUNK (1 << 20)
+
+int nr_breakpoint = 0;
+static vaddr_t breakpoint[MAX_BREAKPOINT];
+
+bool breakpoint_check(vaddr_t pc) {
+  for (int i = 0; i < nr_breakpoint; i ++) {
+    if (breakpoint[i] == pc) return true;
+  }
+  return false;
+}
+
+static bool breakpoint_insert(vaddr_t pc) {
+  if (breakpoint_check(pc)) return true;
+  if (nr_breakpoint == MAX_BREAKPOINT) return false;
+  breakpoint[nr_breakpoint ++] = pc;
+  isa_decode_flush();
+  return true;
+}
+
+static void breakpoint_remove(vaddr_t pc) {
+  for (int i = 0; i < nr_breakpoint; i ++) {
+    if (breakpoint[i] == pc) { breakpoint[i] = breakpoint[-- nr_breakpoint]; break; }
+  }
+}
+
+static const char *gdb_addr = NULL;
+static int gdb_fd = -1;
+static bool no_ack = false;
+
+void gdb_set_addr(const char *addr) {
+  gdb_addr = addr;
+}
+
+// listen on a unix socket if the address is a path, otherwise on a local TCP port
+static int gdb_accept() {
+  int sock;
+  if (strchr(gdb_addr, '/') != NULL) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    Assert(strlen(gdb_addr) < sizeof(addr.sun_path), "path '%s' is too long", gdb_addr);
+    strcpy(addr.sun_path, gdb_addr);
+    unlink(gdb_addr);
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    Assert(sock >= 0 && bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0,
+        "Can not bind to '%s'", gdb_addr);
+  } else {
+    struct sockaddr_in addr = { .sin_family = AF_INET,
+      .sin_port = htons(atoi(gdb_addr)), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    int one = 1;
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    Assert(sock >= 0 && bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == 0,
+        "Can not bind to port %s", gdb_addr);
+  }
+  Assert(listen(sock, 1) == 0, "Can not listen on '%s'", gdb_addr);
+  Log("Waiting for gdb on %s", gdb_addr);
+  int fd = accept(sock, NULL, NULL);
+  Assert(fd >= 0, "Can not accept the connection from gdb");
+  close(sock);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  Log("gdb connected");
+  return fd;
+}
+
+static int get_char() {
+  uint8_t c;
+  return (read(gdb_fd, &c, 1) == 1 ? c : -1);
+}
+
+static void put_packet(const char *data) {
+  static char buf[PACKET_SIZE + 4];
+  uint8_t sum = 0;
+  for (const char *p = data; *p; p ++) sum += *p;
+  int len = snprintf(buf, sizeof(buf), "$%s#%02x", data, sum);
+  while (true) {
+    if (write(gdb_fd, buf, len) != len) return;
+    if (no_ack) return;
+    int c = get_char();
+    if (c == '+' || c < 0) return;
+  }
+}
+
+// return false when gdb is gone
+static bool get_packet(char *buf) {
+  while (true) {
+    int c;
+    while ((c = get_char()) != '$') { if (c < 0) return false; }
+    int len = 0;
+    uint8_t sum = 0;
+    while ((c = get_char()) != '#') {
+      if (c < 0) return false;
+      if (len < PACKET_SIZE - 1) buf[len ++] = c;
+      sum += c;
+    }
+    buf[len] = '\0';
+    char cs[3] = { get_char(), get_char(), '\0' };
+    bool ok = (strtoul(cs, NULL, 16) == sum);
+    if (!no_ack && write(gdb_fd, ok ? "+" : "-", 1) != 1) return false;
+    if (ok) return true;
+  }
+}
+
+static char *hex_word(char *p, word_t val) {
+  for (int i = 0; i < sizeof(word_t); i ++, val >>= 8) p += sprintf(p, "%02x", (uint8_t)val);
+  return p;
+}
+
+static word_t parse_word(const char *p) {
+  word_t val = 0;
+  for (int i = 0; i < sizeof(word_t) && p[0] && p[1]; i ++, p += 2) {
+    char byte[3] = { p[0], p[1], '\0' };
+    val |= (word_t)strtoul(byte, NULL, 16) << (i * 8);
+  }
+  return val;
+}
+
+static bool gdb_interrupted() {
+  struct pollfd pfd = { .fd = gdb_fd, .events = POLLIN };
+  return poll(&pfd, 1, 0) > 0 && get_char() == 0x03;
+}
+
+// run until a breakpoint, the end, or Ctrl-C from gdb, then make the stop reply
+static void gdb_run(bool step, char *reply) {
+  if (breakpoint_check(cpu.pc)) {
+    // step over the breakpoint at pc, which must not get into the decode cache
+    int n = nr_breakpoint;
+    nr_breakpoint = 0;
+    cpu_exec(1);
+    nr_breakpoint = n;
+    isa_decode_flush();
+  } else if (step) {
+    cpu_exec(1);
+  }
+  if (!step) {
+    while (nemu_state.state == NEMU_STOP && !breakpoint_check(cpu.pc) && !gdb_interrupted()) {
+      cpu_exec(RUN_CHUNK);
+    }
+  }
+
+  switch (nemu_state.state) {
+    case NEMU_END: sprintf(reply, "W%02x", (uint8_t)nemu_state.halt_ret); break;
+    case NEMU_ABORT: strcpy(reply, "X06"); break; // SIGABRT
+    case NEMU_QUIT: strcpy(reply, "X09"); break;  // SIGKILL
+    default: strcpy(reply, "S05"); break;         // SIGTRAP
+  }
+}
+
+// return false to close the connection
+static bool gdb_handle(char *pkt, char *reply) {
+  reply[0] = '\0';
+  char *p = reply;
+  word_t val;
+  switch (pkt[0]) {
+    case '?': strcpy(reply, "S05"); break;
+    case 'g':
+      for (int i = 0; isa_gdb_reg_read(i, &val); i ++) p = hex_word(p, val);
+      break;
+    case 'G':
+      for (int i = 0; pkt[1 + i * sizeof(word_t) * 2] != '\0'; i ++) {
+        isa_gdb_reg_write(i, parse_word(pkt + 1 + i * sizeof(word_t) * 2));
+      }
+      strcpy(reply, "OK");
+      break;
+    case 'p':
+      if (isa_gdb_reg_read(strtoul(pkt + 1, NULL, 16), &val)) hex_word(p, val);
+      else strcpy(reply, "E01");
+      break;
+    case 'P': {
+      char *eq = strchr(pkt, '=');
+      bool ok = eq && isa_gdb_reg_write(strtoul(pkt + 1, NULL, 16), parse_word(eq + 1));
+      strcpy(reply, ok ? "OK" : "E01");
+      break;
+    }
+    case 'm': case 'M': {
+      // only the memory is accessible, reading MMIO has side effects
+      char *end;
+      vaddr_t addr = strtoul(pkt + 1, &end, 16);
+      size_t len = strtoul(end + 1, &end, 16);
+      if (len * 2 >= PACKET_SIZE - 4) { strcpy(reply, "E01"); break; }
+      char *data = end + 1;
+      for (size_t i = 0; i < len; i ++) {
+        // by bytes, the pages may be scattered
+        paddr_t paddr;
+        uint8_t *host = (vaddr_probe(addr + i, 1, pkt[0] == 'm' ? MEM_TYPE_READ : MEM_TYPE_WRITE, &paddr) ?
+            paddr_to_host(paddr, 1) : NULL);
+        if (host == NULL) { p = reply; strcpy(reply, "E01"); break; }
+        if (pkt[0] == 'm') p += sprintf(p, "%02x", *host);
+        else if (data[0] && data[1]) {
+          char byte[3] = { data[0], data[1], '\0' };
+          *host = strtoul(byte, NULL, 16);
+          data += 2;
+        }
+      }
+      if (pkt[0] == 'M' && reply[0] == '\0') { isa_decode_flush(); strcpy(reply, "OK"); }
+      break;
+    }
+    case 'c': case 's':
+      if (pkt[1] != '\0') cpu.pc = strtoul(pkt + 1, NULL, 16);
+      gdb_run(pkt[0] == 's', reply);
+      break;
+    case 'Z': case 'z':
+      // software and hardware breakpoints are the same here
+      if (pkt[1] == '0' || pkt[1] == '1') {
+        vaddr_t addr = strtoul(pkt + 3, NULL, 16);
+        bool ok = true;
+        if (pkt[0] == 'Z') ok = breakpoint_insert(addr);
+        else breakpoint_remove(addr);
+        strcpy(reply, ok ? "OK" : "E01");
+      }
+      break;
+    case 'q':
+      if (strncmp(pkt, "qSupported", 10) == 0) sprintf(reply, "PacketSize=%x;QStartNoAckMode+", PACKET_SIZE);
+      else if (strcmp(pkt, "qAttached") == 0) strcpy(reply, "1");
+      break;
+    case 'Q':
+      if (strcmp(pkt, "QStartNoAckMode") == 0) { put_packet("OK"); no_ack = true; reply = NULL; }
+      break;
+    case 'H': strcpy(reply, "OK"); break;
+    case 'k': nemu_state.state = NEMU_QUIT; return false;
+    case 'D':
+      put_packet("OK");
+      // let the guest go on without gdb
+      nr_breakpoint = 0;
+      isa_decode_flush();
+      cpu_exec(-1);
+      return false;
+    default: break; // unsupported, the reply is empty
+  }
+  if (reply != NULL) put_packet(reply);
+  return true;
+}
+
+// return false if gdb is not used
+bool gdb_mainloop() {
+  if (gdb_addr == NULL) return false;
+  static char pkt[PACKET_SIZE], reply[PACKET_SIZE];
+  gdb_fd = gdb_accept();
+  while (get_packet(pkt) && gdb_handle(pkt, reply));
+  close(gdb_fd);
+  if (nemu_state.state == NEMU_STOP || nemu_state.state == NEMU_RUNNING) nemu_state.state = NEMU_QUIT;
+  return true;
+}
+#endif
@@ -38,8 +38,13 @@ static void welcome() {
 
 #ifndef CONFIG_TARGET_AM
 #include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <memory/vaddr.h>
 
 void sdb_set_batch_mode();
+void gdb_set_addr(const char *addr);
 #ifdef CONFIG_FTRACE
 static char *elf_file = NULL;
 #endif
@@ -48,25 +53,95 @@ static char *diff_so_file = NULL;
 static char *img_file = NULL;
 static int difftest_port = 1234;
 
+typedef MUXDEF(CONFIG_ISA64, Elf64_Ehdr, Elf32_Ehdr) Elf_Ehdr;
+typedef MUXDEF(CONFIG_ISA64, Elf64_Phdr, Elf32_Phdr) Elf_Phdr;
+
+// go through a buffer, since pmem may not be accessible to syscalls
+// before it is touched (see PMEM_MMAP)
+static void copy_file(int fd, off_t offset, paddr_t paddr, size_t size) {
+  static uint8_t buf[64 * 1024];
+  while (size > 0) {
+    size_t n = (size < sizeof(buf) ? size : sizeof(buf));
+    ssize_t ret = pread(fd, buf, n, offset);
+    Assert(ret == n, "Can not read '%s' at offset %ld", img_file, (long)offset);
+    memcpy(paddr_to_host(paddr, n), buf, n);
+    offset += n;
+    paddr += n;
+    size -= n;
+  }
+}
+
+// The pages fully covered by the file are mapped copy-on-write if the file
+// offset and the address agree on the offset in a page, so that a large
+// image is loaded without copying. The rest is copied.
+static void load_file(int fd, off_t offset, paddr_t paddr, size_t size) {
+  if (size == 0) return;
+  Assert(paddr_to_host(paddr, size) != NULL,
+      "[" FMT_PADDR ", " FMT_PADDR ") of the image is out of memory", paddr, (paddr_t)(paddr + size));
+  size_t head = size, body = 0;
+  if ((offset & PAGE_MASK) == (paddr & PAGE_MASK)) {
+    head = (-offset) & PAGE_MASK;
+    if (head > size) head = size;
+    body = ROUNDDOWN(size - head, PAGE_SIZE);
+    if (!pmem_map_file(fd, offset + head, paddr + head, body)) body = 0;
+  }
+  copy_file(fd, offset, paddr, head);
+  copy_file(fd, offset + head + body, paddr + head + body, size - head - body);
+}
+
+static long load_elf(int fd) {
+  Elf_Ehdr eh;
+  int ret = pread(fd, &eh, sizeof(eh), 0);
+  Assert(ret == sizeof(eh) && eh.e_ident[EI_CLASS] == MUXDEF(CONFIG_ISA64, ELFCLASS64, ELFCLASS32),
+      "'%s' is not a %d-bit ELF file", img_file, MUXDEF(CONFIG_ISA64, 64, 32));
+
+  paddr_t end = RESET_VECTOR;
+  for (int i = 0; i < eh.e_phnum; i ++) {
+    Elf_Phdr ph;
+    ret = pread(fd, &ph, sizeof(ph), eh.e_phoff + i * eh.e_phentsize);
+    assert(ret == sizeof(ph));
+    if (ph.p_type != PT_LOAD || ph.p_memsz == 0) continue;
+    Assert(paddr_to_host(ph.p_paddr, ph.p_memsz) != NULL,
+        "segment [" FMT_PADDR ", " FMT_PADDR ") is out of memory",
+        (paddr_t)ph.p_paddr, (paddr_t)(ph.p_paddr + ph.p_memsz));
+    load_file(fd, ph.p_offset, ph.p_paddr, ph.p_filesz);
+    // .bss
+    memset(paddr_to_host(ph.p_paddr, ph.p_memsz) + ph.p_filesz, 0, ph.p_memsz - ph.p_filesz);
+    // the range copied to REF only covers pmem
+    if (in_pmem(ph.p_paddr) && ph.p_paddr + ph.p_memsz > end) end = ph.p_paddr + ph.p_memsz;
+  }
+
+  cpu.pc = eh.e_entry;
+  Log("The image is %s (ELF), entry = " FMT_WORD, img_file, cpu.pc);
+  // ftrace takes the symbols from the image unless --elf is given
+  IFDEF(CONFIG_FTRACE, if (elf_file == NULL) elf_file = img_file);
+  // the range copied to REF by difftest
+  return end - RESET_VECTOR;
+}
+
 static long load_img() {
   if (img_file == NULL) {
     Log("No image is given. Use the default build-in image.");
     return 4096; // built-in image size
   }
 
-  FILE *fp = fopen(img_file, "rb");
-  Assert(fp, "Can not open '%s'", img_file);
-
-  fseek(fp, 0, SEEK_END);
-  long size = ftell(fp);
-
-  Log("The image is %s, size = %ld", img_file, size);
-
-  fseek(fp, 0, SEEK_SET);
-  int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
-  assert(ret == 1);
+  int fd = open(img_file, O_RDONLY);
+  Assert(fd >= 0, "Can not open '%s'", img_file);
+
+  long size;
+  char magic[SELFMAG];
+  if (pread(fd, magic, SELFMAG, 0) == SELFMAG && memcmp(magic, ELFMAG, SELFMAG) == 0) {
+    size = load_elf(fd);
+  } else {
+    struct stat st;
+    int ret = fstat(fd, &st);
+    assert(ret == 0);
+    size = st.st_size;
+    Log("The image is %s, size = %ld", img_file, size);
+    load_file(fd, 0, RESET_VECTOR, size);
+  }
 
-  fclose(fp);
+  close(fd);
   return size;
 }
 
@@ -80,14 +155,14 @@ static int parse_args(int argc, char *argv[]) {
     #ifdef CONFIG_FTRACE
     {"elf"      , required_argument, NULL, 'e'},
     #endif
+    #ifdef CONFIG_GDB_STUB
+    {"gdb"      , required_argument, NULL, 'g'},
+    #endif
     {0          , 0                , NULL,  0 },
   };
   int o;
-  #ifdef CONFIG_FTRACE
-    while ( (o = getopt_long(argc, argv, "-bhl:d:p:e:", table, NULL)) != -1) {
-  #else
-    while ( (o = getopt_long(argc, argv, "-bhl:d:p:", table, NULL)) != -1) {
-  #endif
+  const char *optstr = "-bhl:d:p:" IFDEF(CONFIG_FTRACE, "e:") IFDEF(CONFIG_GDB_STUB, "g:");
+  while ( (o = getopt_long(argc, argv, optstr, table, NULL)) != -1) {
     switch (o) {
       case 'b': sdb_set_batch_mode(); break;
       case 'p': sscanf(optarg, "%d", &difftest_port); break;
@@ -96,6 +171,9 @@ static int parse_args(int argc, char *argv[]) {
       #ifdef CONFIG_FTRACE
       case 'e': elf_file = optarg; break; // <-- 新增 case
       #endif
+      #ifdef CONFIG_GDB_STUB
+      case 'g': gdb_set_addr(optarg); break;
+      #endif
       case 1: img_file = optarg; return 0;
       default:
         printf("Usage: %s [OPTION...] IMAGE [args]\n\n", argv[0]);
@@ -103,6 +181,7 @@ static int parse_args(int argc, char *argv[]) {
         printf("\t-l,--log=FILE           output log to FILE\n");
         printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
         printf("\t-p,--port=PORT          run DiffTest with port PORT\n");
+        IFDEF(CONFIG_GDB_STUB, printf("\t-g,--gdb=PORT|PATH      wait for gdb on a local TCP port or a unix socket\n"));
         printf("\n");
         exit(0);
     }
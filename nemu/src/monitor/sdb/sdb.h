@@ -38,3 +38,4 @@ WP* new_wp();
 void free_wp(int no);
 void display_watchpoints();
 bool check_watchpoints();
+bool has_watchpoint();
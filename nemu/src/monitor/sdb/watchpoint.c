@@ -135,6 +135,10 @@ void display_watchpoints() {
   }
 }
 
+bool has_watchpoint() {
+  return head != NULL;
+}
+
 // 检查所有监视点的值是否发生变化
 bool check_watchpoints() {
   bool triggered = false;
@@ -30,8 +30,15 @@ void init_log(const char *log_file) {
   Log("Log is written to %s", log_file ? log_file : "stdout");
 }
 
+static bool log_forced = false;
+
+// ignore CONFIG_TRACE_START and CONFIG_TRACE_END from now on
+void log_force_enable() {
+  log_forced = true;
+}
+
 bool log_enable() {
-  return MUXDEF(CONFIG_TRACE, (g_nr_guest_inst >= CONFIG_TRACE_START) &&
-         (g_nr_guest_inst <= CONFIG_TRACE_END), false);
+  return log_forced || MUXDEF(CONFIG_TRACE, ((g_nr_guest_inst >= CONFIG_TRACE_START) &&
+         (g_nr_guest_inst <= CONFIG_TRACE_END)), false);
 }
 #endif
@@ -0,0 +1,271 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <dlfcn.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <fuzz.h>
+
+enum { DIFFTEST_TO_DUT, DIFFTEST_TO_REF };
+
+typedef struct {
+  const char *name;
+  void (*memcpy)(uint32_t addr, void *buf, size_t n, bool direction);
+  void (*regcpy)(void *dut, bool direction);
+  void (*exec)(uint64_t n);
+} Sim;
+
+static Sim dut, ref;
+
+static int nr_job = 0;
+static int nr_prog = 1000;
+static int nr_unit = 64;
+static uint64_t seed = 0;
+static bool single = false;
+static const char *out_dir = ".";
+
+static void load_sim(Sim *s, const char *so_file) {
+  void *handle = dlopen(so_file, RTLD_LAZY);
+  if (handle == NULL) {
+    fprintf(stderr, "can not load %s: %s\n", so_file, dlerror());
+    exit(1);
+  }
+  s->name = so_file;
+  s->memcpy = dlsym(handle, "difftest_memcpy");
+  s->regcpy = dlsym(handle, "difftest_regcpy");
+  s->exec = dlsym(handle, "difftest_exec");
+  void (*init)(int) = dlsym(handle, "difftest_init");
+  assert(s->memcpy && s->regcpy && s->exec && init);
+  init(0);
+}
+
+static void load_prog(Sim *s, Prog *p, uint32_t *img, int n) {
+  s->memcpy(PROG_BASE, img, n * sizeof(img[0]), DIFFTEST_TO_REF);
+  s->memcpy(DATA_BASE, p->data, DATA_SIZE, DIFFTEST_TO_REF);
+  s->regcpy(&p->init, DIFFTEST_TO_REF);
+}
+
+// return true if DUT and REF agree on the whole program
+static bool run_prog(Prog *p, bool verbose) {
+  static uint32_t img[MAX_IMG_INST];
+  int n = prog_to_image(p, img);
+  uint32_t end = PROG_BASE + (n - 1) * 4;
+  load_prog(&dut, p, img, n);
+  load_prog(&ref, p, img, n);
+
+  Context d, r;
+  for (int i = 0; i < n; i ++) {
+    uint32_t pc = (i == 0 ? PROG_BASE : d.pc);
+    dut.exec(1);
+    ref.exec(1);
+    dut.regcpy(&d, DIFFTEST_TO_DUT);
+    ref.regcpy(&r, DIFFTEST_TO_DUT);
+    for (int j = 0; j < 32; j ++) {
+      if (d.gpr[j] != r.gpr[j]) {
+        if (verbose) printf("x%d is different after executing instruction 0x%08x at pc = 0x%08x, "
+            "right = 0x%08x, wrong = 0x%08x\n", j, img[(pc - PROG_BASE) / 4], pc, r.gpr[j], d.gpr[j]);
+        return false;
+      }
+    }
+    if (d.pc != r.pc) {
+      if (verbose) printf("pc is different after executing instruction 0x%08x at pc = 0x%08x, "
+          "right = 0x%08x, wrong = 0x%08x\n", img[(pc - PROG_BASE) / 4], pc, r.pc, d.pc);
+      return false;
+    }
+    if (d.pc == end) break;
+  }
+  if (d.pc != end) {
+    if (verbose) printf("the end of the program is not reached, pc = 0x%08x\n", d.pc);
+    return false;
+  }
+
+  static uint8_t dmem[DATA_SIZE], rmem[DATA_SIZE];
+  dut.memcpy(DATA_BASE, dmem, DATA_SIZE, DIFFTEST_TO_DUT);
+  ref.memcpy(DATA_BASE, rmem, DATA_SIZE, DIFFTEST_TO_DUT);
+  for (int i = 0; i < DATA_SIZE; i ++) {
+    if (dmem[i] != rmem[i]) {
+      if (verbose) printf("memory[0x%08x] is different, right = 0x%02x, wrong = 0x%02x\n",
+          DATA_BASE + i, rmem[i], dmem[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+// Run in a child process, so that DUT and REF start from the same state
+// every time, and a crash of either of them is also caught as a failure.
+static bool test_prog(Prog *p, bool verbose) {
+  fflush(stdout);
+  pid_t pid = fork();
+  assert(pid >= 0);
+  if (pid == 0) _exit(run_prog(p, verbose) ? 0 : 1);
+
+  int status;
+  waitpid(pid, &status, 0);
+  if (WIFSIGNALED(status)) {
+    if (verbose) printf("killed by signal %d\n", WTERMSIG(status));
+    return false;
+  }
+  return WEXITSTATUS(status) == 0;
+}
+
+static bool remove_units(Prog *p, int from, int to) {
+  bool changed = false;
+  for (int i = from; i < to && i < p->nr_unit; i ++) {
+    if (!p->unit[i].removed) { p->unit[i].removed = true; changed = true; }
+  }
+  return changed;
+}
+
+// delta debugging: remove as many units as possible while keeping the failure,
+// then try to clear the initial registers
+static void minimize(Prog *p) {
+  static Prog t;
+  bool progress = true;
+  while (progress) {
+    progress = false;
+    for (int chunk = p->nr_unit / 2; chunk >= 1; chunk /= 2) {
+      for (int i = 0; i < p->nr_unit; i += chunk) {
+        t = *p;
+        if (remove_units(&t, i, i + chunk) && !test_prog(&t, false)) {
+          *p = t;
+          progress = true;
+        }
+      }
+    }
+  }
+
+  for (int i = 1; i < 32; i ++) {
+    if (i == BASE_REG || p->init.gpr[i] == 0) continue;
+    t = *p;
+    t.init.gpr[i] = 0;
+    if (!test_prog(&t, false)) *p = t;
+  }
+}
+
+static void report(Prog *p) {
+  static uint32_t img[MAX_IMG_INST];
+  int n = prog_to_image(p, img);
+
+  char path[256];
+  snprintf(path, sizeof(path), "%s/fail-%" PRIu64 ".bin", out_dir, p->seed);
+  FILE *fp = fopen(path, "wb");
+  if (fp != NULL) {
+    fwrite(img, sizeof(img[0]), n, fp);
+    fclose(fp);
+  }
+
+  // build the whole report first, since other workers are printing as well
+  char *buf = NULL;
+  size_t size = 0;
+  FILE *out = open_memstream(&buf, &size);
+  fprintf(out, "==== seed %" PRIu64 " fails, minimized program is saved to %s\n", p->seed, path);
+  for (int i = 1; i < 32; i ++) {
+    if (p->init.gpr[i] != 0) fprintf(out, "  x%d = 0x%08x\n", i, p->init.gpr[i]);
+  }
+  for (int i = 0; i < n; i ++) {
+    if (img[i] != 0x00000013) fprintf(out, "  0x%08x: %08x\n", PROG_BASE + i * 4, img[i]);
+  }
+  fclose(out);
+  fputs(buf, stdout);
+  free(buf);
+  test_prog(p, true);
+}
+
+static int worker(int id, const char *dut_so, const char *ref_so) {
+  load_sim(&dut, dut_so);
+  load_sim(&ref, ref_so);
+
+  static Prog p;
+  int nr_fail = 0;
+  for (int i = id; i < nr_prog; i += nr_job) {
+    gen_prog(&p, seed + i, nr_unit);
+    if (test_prog(&p, false)) continue;
+    nr_fail ++;
+    minimize(&p);
+    report(&p);
+  }
+  return nr_fail;
+}
+
+static void usage(const char *name) {
+  printf("Usage: %s [OPTION...] DUT_SO REF_SO\n\n", name);
+  printf("\t-j,--jobs=N     run N workers in parallel (default: number of cores)\n");
+  printf("\t-n,--num=N      test N programs in total (default: %d)\n", nr_prog);
+  printf("\t-l,--len=N      generate N instructions per program (default: %d)\n", nr_unit);
+  printf("\t-s,--seed=S     seed of the first program (default: time)\n");
+  printf("\t-1,--single     only test the program with seed S\n");
+  printf("\t-o,--out=DIR    save failing programs to DIR (default: .)\n");
+  printf("\n");
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  const struct option table[] = {
+    {"jobs"  , required_argument, NULL, 'j'},
+    {"num"   , required_argument, NULL, 'n'},
+    {"len"   , required_argument, NULL, 'l'},
+    {"seed"  , required_argument, NULL, 's'},
+    {"single", no_argument      , NULL, '1'},
+    {"out"   , required_argument, NULL, 'o'},
+    {"help"  , no_argument      , NULL, 'h'},
+    {0       , 0                , NULL,  0 },
+  };
+  seed = time(NULL);
+  int o;
+  while ((o = getopt_long(argc, argv, "j:n:l:s:1o:h", table, NULL)) != -1) {
+    switch (o) {
+      case 'j': nr_job = atoi(optarg); break;
+      case 'n': nr_prog = atoi(optarg); break;
+      case 'l': nr_unit = atoi(optarg); break;
+      case 's': seed = strtoull(optarg, NULL, 0); break;
+      case '1': single = true; break;
+      case 'o': out_dir = optarg; break;
+      default: usage(argv[0]);
+    }
+  }
+  if (argc - optind != 2) usage(argv[0]);
+  if (nr_unit < 1 || nr_unit > MAX_UNIT) { fprintf(stderr, "len should be in [1, %d]\n", MAX_UNIT); return 1; }
+  if (single) { nr_prog = 1; nr_job = 1; }
+  if (nr_job <= 0) nr_job = sysconf(_SC_NPROCESSORS_ONLN);
+  if (nr_job > nr_prog) nr_job = nr_prog;
+  setvbuf(stdout, NULL, _IOLBF, 0);
+
+  printf("testing %d programs (seed %" PRIu64 " ~ %" PRIu64 ") with %d workers\n",
+      nr_prog, seed, seed + nr_prog - 1, nr_job);
+  for (int i = 0; i < nr_job; i ++) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      int nr_fail = worker(i, argv[optind], argv[optind + 1]);
+      fflush(stdout);
+      _exit(nr_fail > 255 ? 255 : nr_fail);
+    }
+  }
+
+  int nr_fail = 0;
+  for (int i = 0; i < nr_job; i ++) {
+    int status;
+    wait(&status);
+    if (WIFEXITED(status)) nr_fail += WEXITSTATUS(status);
+    else nr_fail ++;
+  }
+  printf("%d of %d programs fail\n", nr_fail, nr_prog);
+  return nr_fail != 0;
+}
@@ -0,0 +1,186 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#include <fuzz.h>
+
+// xorshift64*, so that a program can be reproduced from its seed on any host
+static uint64_t rng_state = 1;
+
+static uint32_t rnd() {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return (rng_state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static int choose(int n) { return rnd() % n; }
+
+#define R_TYPE(f7, rs2, rs1, f3, rd, op) \
+  (((f7) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define I_TYPE(imm, rs1, f3, rd, op) \
+  ((((imm) & 0xfff) << 20) | ((rs1) << 15) | ((f3) << 12) | ((rd) << 7) | (op))
+#define S_TYPE(imm, rs2, rs1, f3, op) \
+  (((((imm) >> 5) & 0x7f) << 25) | ((rs2) << 20) | ((rs1) << 15) | ((f3) << 12) | (((imm) & 0x1f) << 7) | (op))
+#define U_TYPE(imm, rd, op) (((imm) & 0xfffff000) | ((rd) << 7) | (op))
+
+#define NOP 0x00000013 // addi zero, zero, 0
+#define END 0x0000006f // jal zero, 0
+
+// corner cases of the M extension and shifts show up with these values
+static const uint32_t special[] = {
+  0, 1, 2, 0x7fffffff, 0x80000000, 0x80000001, 0xffffffff, 0xfffffffe, 31, 32,
+};
+
+static uint32_t rnd_value() {
+  return (choose(2) ? special[choose(sizeof(special) / sizeof(special[0]))] : rnd());
+}
+
+// the base register of loads and stores is never written
+static int rnd_rd() {
+  int rd;
+  do { rd = choose(32); } while (rd == BASE_REG);
+  return rd;
+}
+
+static int rnd_rs() { return choose(32); }
+
+static int rnd_target(Prog *p, int idx) {
+  // forward only, so that every program terminates
+  int max = p->nr_unit - idx;
+  if (max > 16) max = 16;
+  return idx + 1 + choose(max);
+}
+
+static void gen_unit(Prog *p, int idx) {
+  static const struct { uint32_t f7, f3; } alu_r[] = {
+    {0x00, 0}, {0x20, 0}, {0x00, 1}, {0x00, 2}, {0x00, 3}, {0x00, 4}, {0x00, 5}, {0x20, 5}, {0x00, 6}, {0x00, 7}, // RV32I
+    {0x01, 0}, {0x01, 1}, {0x01, 2}, {0x01, 3}, {0x01, 4}, {0x01, 5}, {0x01, 6}, {0x01, 7}, // RV32M
+  };
+  static const uint32_t alu_i[] = { 0, 2, 3, 4, 6, 7 };  // addi slti sltiu xori ori andi
+  static const uint32_t branch[] = { 0, 1, 4, 5, 6, 7 }; // beq bne blt bge bltu bgeu
+  static const struct { uint32_t f3; int size; } load[] = { {0, 1}, {1, 2}, {2, 4}, {4, 1}, {5, 2} };
+  static const struct { uint32_t f3; int size; } store[] = { {0, 1}, {1, 2}, {2, 4} };
+
+  Unit *u = &p->unit[idx];
+  u->len = 1;
+  u->target = -1;
+  u->removed = false;
+
+  int offset, size, k;
+  switch (choose(12)) {
+    case 0: case 1: case 2: case 3:
+      k = choose(sizeof(alu_r) / sizeof(alu_r[0]));
+      u->inst[0] = R_TYPE(alu_r[k].f7, rnd_rs(), rnd_rs(), alu_r[k].f3, rnd_rd(), 0x33);
+      break;
+    case 4: case 5:
+      u->inst[0] = I_TYPE(rnd(), rnd_rs(), alu_i[choose(6)], rnd_rd(), 0x13);
+      break;
+    case 6:
+      switch (choose(3)) {
+        case 0: u->inst[0] = R_TYPE(0x00, choose(32), rnd_rs(), 1, rnd_rd(), 0x13); break; // slli
+        case 1: u->inst[0] = R_TYPE(0x00, choose(32), rnd_rs(), 5, rnd_rd(), 0x13); break; // srli
+        default: u->inst[0] = R_TYPE(0x20, choose(32), rnd_rs(), 5, rnd_rd(), 0x13); break; // srai
+      }
+      break;
+    case 7:
+      u->inst[0] = U_TYPE(rnd_value(), rnd_rd(), choose(2) ? 0x37 : 0x17); // lui, auipc
+      break;
+    case 8:
+      k = choose(5);
+      size = load[k].size;
+      offset = (int)(rnd() % (DATA_SIZE / size)) * size - DATA_SIZE / 2;
+      u->inst[0] = I_TYPE(offset, BASE_REG, load[k].f3, rnd_rd(), 0x03);
+      break;
+    case 9:
+      k = choose(3);
+      size = store[k].size;
+      offset = (int)(rnd() % (DATA_SIZE / size)) * size - DATA_SIZE / 2;
+      u->inst[0] = S_TYPE(offset, rnd_rs(), BASE_REG, store[k].f3, 0x23);
+      break;
+    case 10:
+      u->inst[0] = R_TYPE(0, rnd_rs(), rnd_rs(), branch[choose(6)], 0, 0x63);
+      u->target = rnd_target(p, idx);
+      break;
+    default:
+      if (choose(2)) {
+        u->inst[0] = 0x6f | (rnd_rd() << 7); // jal
+      } else {
+        // auipc tmp, 0; jalr rd, offset(tmp)
+        int tmp = rnd_rd();
+        if (tmp == 0) tmp = 1;
+        u->len = 2;
+        u->inst[0] = U_TYPE(0, tmp, 0x17);
+        u->inst[1] = I_TYPE(0, tmp, 0, rnd_rd(), 0x67);
+      }
+      u->target = rnd_target(p, idx);
+      break;
+  }
+}
+
+void gen_prog(Prog *p, uint64_t seed, int nr_unit) {
+  assert(nr_unit > 0 && nr_unit <= MAX_UNIT);
+  rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+  p->seed = seed;
+  p->nr_unit = nr_unit;
+  for (int i = 0; i < 32; i ++) p->init.gpr[i] = rnd_value();
+  p->init.gpr[0] = 0;
+  p->init.gpr[BASE_REG] = DATA_BASE + DATA_SIZE / 2;
+  p->init.pc = PROG_BASE;
+  for (int i = 0; i < DATA_SIZE; i ++) p->data[i] = rnd();
+  for (int i = 0; i < nr_unit; i ++) gen_unit(p, i);
+}
+
+int prog_to_image(Prog *p, uint32_t *img) {
+  int start[MAX_UNIT + 1];
+  int n = 0;
+  for (int i = 0; i < p->nr_unit; i ++) {
+    start[i] = n;
+    n += p->unit[i].len;
+  }
+  start[p->nr_unit] = n;
+
+  for (int i = 0; i < p->nr_unit; i ++) {
+    Unit *u = &p->unit[i];
+    uint32_t *dst = &img[start[i]];
+    if (u->removed) {
+      for (int j = 0; j < u->len; j ++) dst[j] = NOP;
+      continue;
+    }
+    memcpy(dst, u->inst, sizeof(u->inst[0]) * u->len);
+    if (u->target < 0) continue;
+
+    uint32_t *last = &dst[u->len - 1];
+    int32_t imm = (start[u->target] - (start[i] + u->len - 1)) * 4;
+    switch (*last & 0x7f) {
+      case 0x63: // branch
+        *last = (*last & 0x01fff07f) | (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3f) << 25) |
+          (((imm >> 1) & 0xf) << 8) | (((imm >> 11) & 1) << 7);
+        break;
+      case 0x6f: // jal
+        *last = (*last & 0xfff) | (((imm >> 20) & 1) << 31) | (((imm >> 1) & 0x3ff) << 21) |
+          (((imm >> 11) & 1) << 20) | (((imm >> 12) & 0xff) << 12);
+        break;
+      case 0x67: // jalr, relative to the auipc before it
+        imm += 4;
+        assert(imm < 2048);
+        *last = (*last & 0xfffff) | ((imm & 0xfff) << 20);
+        break;
+      default: assert(0);
+    }
+  }
+  img[n ++] = END;
+  return n;
+}
@@ -0,0 +1,64 @@
+/***************************************************************************************
+* Copyright (c) 2014-2024 Zihao Yu, Nanjing University
+*
+* NEMU is licensed under Mulan PSL v2.
+* You can use this software according to the terms and conditions of the Mulan PSL v2.
+* You may obtain a copy of Mulan PSL v2 at:
+*          http://license.coscl.org.cn/MulanPSL2
+*
+* THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY KIND,
+* EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO NON-INFRINGEMENT,
+* MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+*
+* See the Mulan PSL v2 for more details.
+***************************************************************************************/
+
+
+#ifndef __FUZZ_H__
+#define __FUZZ_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+// Only riscv32 is supported. The layout of the registers exchanged by
+// difftest_regcpy() follows riscv32_CPU_state in NEMU.
+#define PROG_BASE 0x80000000u
+#define DATA_BASE 0x80100000u // the region accessed by loads and stores
+#define DATA_SIZE 4096
+#define BASE_REG  3           // gp, always points to the middle of the data region
+#define MAX_UNIT  1024
+
+typedef struct {
+  uint32_t gpr[32];
+  uint32_t pc;
+} Context;
+
+// A unit is the smallest piece of a program which can be removed during
+// minimization. A removed unit is replaced by nops of the same length, so
+// the offsets of branches are kept.
+typedef struct {
+  uint32_t inst[2];
+  int len;
+  int target;   // index of the unit a control transfer jumps to, -1 if none
+  bool removed;
+} Unit;
+
+typedef struct {
+  uint64_t seed;
+  Context init;                // initial registers
+  uint8_t data[DATA_SIZE];     // initial content of the data region
+  int nr_unit;
+  Unit unit[MAX_UNIT];
+} Prog;
+
+#define MAX_IMG_INST (MAX_UNIT * 2 + 1)
+
+void gen_prog(Prog *p, uint64_t seed, int nr_unit);
+// return the number of instructions, the last one is an endless loop
+int prog_to_image(Prog *p, uint32_t *img);
+
+#endif
@@ -73,6 +73,20 @@ static void kvm_set_step_mode(bool watch, uint32_t watch_addr) {
   }
 }
 
+// Run freely (without single-stepping) until the instruction at `bp_addr`
+// is about to be fetched. DR0 is kept for `watch_addr` in kvm_set_step_mode(),
+// so the breakpoint is set with DR1.
+static void kvm_set_run_mode(uint32_t bp_addr) {
+  struct kvm_guest_debug debug = {};
+  debug.control = KVM_GUESTDBG_ENABLE | KVM_GUESTDBG_USE_HW_BP;
+  debug.arch.debugreg[1] = bp_addr;
+  debug.arch.debugreg[7] = 0x4; // watch instruction fetch at `bp_addr`
+  if (ioctl(vcpu.fd, KVM_SET_GUEST_DEBUG, &debug) < 0) {
+    perror("KVM_SET_GUEST_DEBUG");
+    assert(0);
+  }
+}
+
 static void kvm_setregs(const struct kvm_regs *r) {
   if (ioctl(vcpu.fd, KVM_SET_REGS, r) < 0) {
     perror("KVM_SET_REGS");
@@ -328,6 +342,46 @@ static void kvm_exec(uint64_t n) {
   }
 }
 
+// Run the straight-line block observed by NEMU, which consists of `n`
+// instructions and ends at `last_pc`. Since there is no control transfer
+// before `last_pc`, the first hit of the breakpoint is exactly the end of
+// the block, so only one VM exit is needed before stepping `last_pc` itself.
+// Note that the patching for pushf/popf is not needed in this mode, since
+// TF is cleared during the run, but the upper bits of push %ds/%es/%fs are
+// not fixed, and the memory written by them may be different from NEMU.
+static void kvm_exec_block(uint32_t last_pc, uint64_t n) {
+  if (n <= 1 || vcpu.int_wp_state != STATE_IDLE) {
+    kvm_exec(n);
+    return;
+  }
+
+  struct kvm_regs *r = &vcpu.kvm_run->s.regs.regs;
+  r->rflags &= ~RFLAGS_TF;
+  vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+  kvm_set_run_mode(last_pc);
+
+  while (1) {
+    if (ioctl(vcpu.fd, KVM_RUN, 0) < 0) {
+      if (errno == EINTR) continue;
+      perror("KVM_RUN");
+      assert(0);
+    }
+    break;
+  }
+
+  int reason = vcpu.kvm_run->exit_reason;
+  r->rflags |= RFLAGS_TF;
+  vcpu.kvm_run->kvm_dirty_regs = KVM_SYNC_X86_REGS;
+  kvm_set_step_mode(false, 0);
+  if (reason == KVM_EXIT_HLT) return;
+  Assert(reason == KVM_EXIT_DEBUG && vcpu.kvm_run->debug.arch.pc == last_pc,
+      "Got exit_reason %d at pc = 0x%llx, expected KVM_EXIT_DEBUG (%d) at pc = 0x%x",
+      reason, vcpu.kvm_run->s.regs.regs.rip, KVM_EXIT_DEBUG, last_pc);
+
+  // the control transfer at the end of the block
+  kvm_exec(1);
+}
+
 static void run_protected_mode() {
   struct kvm_sregs sregs;
   kvm_getsregs(&sregs);
@@ -383,6 +437,10 @@ __EXPORT void difftest_exec(uint64_t n) {
   kvm_exec(n);
 }
 
+__EXPORT void difftest_exec_block(uint64_t last_pc, uint64_t n) {
+  kvm_exec_block(last_pc, n);
+}
+
 __EXPORT void difftest_raise_intr(word_t NO) {
   uint32_t pgate_vaddr = vcpu.kvm_run->s.regs.sregs.idt.base + NO * 8;
   uint32_t pgate = va2pa(pgate_vaddr);
@@ -0,0 +1,76 @@
+#include <cstdlib>
+#include <dlfcn.h>
+#include <npc.h>
+#include <difftest-def.h>
+
+static_assert(sizeof(CPUState) == DIFFTEST_REG_SIZE, "CPUState does not match the REF");
+
+static void (*ref_difftest_memcpy)(paddr_t addr, void *buf, size_t n, bool direction) = NULL;
+static void (*ref_difftest_regcpy)(void *dut, bool direction) = NULL;
+static void (*ref_difftest_exec)(uint64_t n) = NULL;
+
+static bool is_enabled = false;
+
+void init_difftest(const char *ref_so_file, long img_size) {
+  if (ref_so_file == NULL) return;
+
+  void *handle = dlopen(ref_so_file, RTLD_LAZY);
+  if (handle == NULL) {
+    printf("Can not load REF '%s': %s\n", ref_so_file, dlerror());
+    exit(EXIT_FAILURE);
+  }
+
+  ref_difftest_memcpy = (decltype(ref_difftest_memcpy))dlsym(handle, "difftest_memcpy");
+  assert(ref_difftest_memcpy);
+
+  ref_difftest_regcpy = (decltype(ref_difftest_regcpy))dlsym(handle, "difftest_regcpy");
+  assert(ref_difftest_regcpy);
+
+  ref_difftest_exec = (decltype(ref_difftest_exec))dlsym(handle, "difftest_exec");
+  assert(ref_difftest_exec);
+
+  void (*ref_difftest_init)(int) = (void (*)(int))dlsym(handle, "difftest_init");
+  assert(ref_difftest_init);
+
+  printf("Differential testing: ON, REF = %s\n", ref_so_file);
+
+  ref_difftest_init(0);
+  ref_difftest_memcpy(RESET_VECTOR, guest_to_host(RESET_VECTOR), img_size, DIFFTEST_TO_REF);
+  CPUState dut;
+  npc_get_state(&dut);
+  ref_difftest_regcpy(&dut, DIFFTEST_TO_REF);
+  is_enabled = true;
+}
+
+static bool check_reg(const char *name, word_t pc, word_t ref, word_t dut) {
+  if (ref != dut) {
+    printf("difftest: %s is different after executing instruction at pc = 0x%08x, "
+        "right = 0x%08x, wrong = 0x%08x\n", name, pc, ref, dut);
+    return false;
+  }
+  return true;
+}
+
+// pc 为刚刚提交的指令的地址
+void difftest_step(word_t pc) {
+  if (!is_enabled) return;
+
+  CPUState ref, dut;
+  ref_difftest_exec(1);
+  ref_difftest_regcpy(&ref, DIFFTEST_TO_DUT);
+  npc_get_state(&dut);
+
+  bool ok = true;
+  for (int i = 0; i < 32 && ok; i++) {
+    char name[8];
+    snprintf(name, sizeof(name), "x%d", i);
+    ok = check_reg(name, pc, ref.gpr[i], dut.gpr[i]);
+  }
+  if (ok) ok = check_reg("pc", pc, ref.pc, dut.pc);
+
+  if (!ok) {
+    npc_reg_display();
+    npc_state.state = NPC_ABORT;
+    npc_state.halt_pc = pc;
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef __NPC_H__
+#define __NPC_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <cassert>
+
+typedef uint32_t word_t;
+typedef uint32_t paddr_t;
+
+// 与 AM 的 npc 平台保持一致
+#define MBASE 0x80000000u
+#define MSIZE 0x8000000u
+#define RESET_VECTOR MBASE
+
+enum { NPC_RUNNING, NPC_END, NPC_ABORT };
+
+typedef struct {
+  int state;
+  word_t halt_pc;
+  word_t halt_ret;
+} NPCState;
+
+extern NPCState npc_state;
+
+// 与 NEMU 中 riscv32 的 CPU_state 布局相同, 用于和 REF 交换寄存器
+typedef struct {
+  word_t gpr[32];
+  word_t pc;
+} CPUState;
+
+// mem.cpp
+bool in_pmem(paddr_t addr);
+uint8_t* guest_to_host(paddr_t addr);
+word_t paddr_read(paddr_t addr);
+long load_img(const char *img_file);
+
+// main.cpp
+void npc_get_state(CPUState *s);
+void npc_reg_display();
+
+// difftest.cpp
+void init_difftest(const char *ref_so_file, long img_size);
+void difftest_step(word_t pc);
+
+#endif
@@ -0,0 +1,140 @@
+#include <cinttypes>
+#include <cstdlib>
+#include <getopt.h>
+#include <verilated.h>
+#include <verilated_dpi.h>
+#include <npc.h>
+#include "Vtop.h"
+#include "Vtop__Dpi.h"
+
+// 单条指令最多等待的周期数, 超过则认为处理器卡死
+#define MAX_CYCLES_PER_INST 1000
+
+NPCState npc_state = { .state = NPC_RUNNING };
+
+static Vtop *top = NULL;
+static uint32_t *cpu_gpr = NULL;
+static bool is_commit = false;
+static word_t commit_pc = 0;
+static uint64_t nr_cycle = 0;
+static uint64_t nr_inst = 0;
+
+static const char *regs[] = {
+  "$0", "ra", "sp", "gp", "tp", "t0", "t1", "t2",
+  "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+  "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7",
+  "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
+};
+
+// ---- DPI-C, 由 RTL 调用 ----
+extern "C" void set_gpr_ptr(const svOpenArrayHandle r) {
+  cpu_gpr = (uint32_t *)(((VerilatedDpiOpenVar *)r)->datap());
+}
+
+extern "C" void npc_commit(int pc) {
+  is_commit = true;
+  commit_pc = pc;
+}
+
+extern "C" void npc_trap(int code) {
+  npc_state.state = NPC_END;
+  npc_state.halt_ret = code;
+}
+
+void npc_get_state(CPUState *s) {
+  for (int i = 0; i < 32; i++) s->gpr[i] = cpu_gpr[i];
+  s->pc = top->i_pc;
+}
+
+void npc_reg_display() {
+  for (int i = 0; i < 32; i++) {
+    printf("%-4s 0x%08x%c", regs[i], cpu_gpr[i], (i % 4 == 3 ? '\n' : ' '));
+  }
+  printf("pc   0x%08x\n", top->i_pc);
+}
+
+static void single_cycle() {
+  top->clk = 0;
+  // 复位期间 PC 还没有被置为复位值, 不取指
+  if (top->rst_n) top->i_inst = paddr_read(top->i_pc);
+  top->eval();
+  top->clk = 1;
+  top->eval();
+  nr_cycle ++;
+}
+
+static void reset(int n) {
+  top->rst_n = 0;
+  while (n -- > 0) single_cycle();
+  top->rst_n = 1;
+}
+
+// 推进时钟, 直到有一条指令提交
+static void exec_once() {
+  is_commit = false;
+  for (int i = 0; !is_commit; i ++) {
+    if (npc_state.state == NPC_ABORT) return;
+    if (i == MAX_CYCLES_PER_INST) {
+      printf("no instruction is committed in %d cycles at pc = 0x%08x\n", i, top->i_pc);
+      npc_state.state = NPC_ABORT;
+      npc_state.halt_pc = top->i_pc;
+      return;
+    }
+    single_cycle();
+  }
+  nr_inst ++;
+  if (npc_state.state == NPC_END) npc_state.halt_pc = commit_pc;
+}
+
+static void execute() {
+  while (npc_state.state == NPC_RUNNING) {
+    exec_once();
+    // 提交 ebreak 后仿真结束, 不再与 REF 比较
+    if (npc_state.state != NPC_RUNNING) break;
+    difftest_step(commit_pc);
+  }
+}
+
+static const char *img_file = NULL;
+static const char *diff_so_file = NULL;
+
+static void parse_args(int argc, char *argv[]) {
+  const struct option table[] = {
+    {"diff", required_argument, NULL, 'd'},
+    {"help", no_argument      , NULL, 'h'},
+    {0     , 0                , NULL,  0 },
+  };
+  int o;
+  while ((o = getopt_long(argc, argv, "-hd:", table, NULL)) != -1) {
+    switch (o) {
+      case 'd': diff_so_file = optarg; break;
+      case 1: img_file = optarg; break;
+      default:
+        printf("Usage: %s [OPTION...] IMAGE\n\n", argv[0]);
+        printf("\t-d,--diff=REF_SO        run DiffTest with reference REF_SO\n");
+        printf("\n");
+        exit(0);
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  Verilated::commandArgs(argc, argv);
+  parse_args(argc, argv);
+
+  top = new Vtop;
+  long img_size = load_img(img_file);
+  reset(10);
+  init_difftest(diff_so_file, img_size);
+
+  execute();
+
+  const char *result = (npc_state.state == NPC_ABORT ? "\33[1;31mABORT\33[0m" :
+      (npc_state.halt_ret == 0 ? "\33[1;32mHIT GOOD TRAP\33[0m" : "\33[1;31mHIT BAD TRAP\33[0m"));
+  printf("npc: %s at pc = 0x%08x\n", result, npc_state.halt_pc);
+  printf("total guest instructions = %" PRIu64 ", cycles = %" PRIu64 "\n", nr_inst, nr_cycle);
+
+  top->final();
+  delete top;
+  return !(npc_state.state == NPC_END && npc_state.halt_ret == 0);
+}
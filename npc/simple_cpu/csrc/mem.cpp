@@ -0,0 +1,54 @@
+#include <cstdlib>
+#include <cstring>
+#include <npc.h>
+
+static uint8_t pmem[MSIZE] __attribute((aligned(4096))) = {};
+
+// 没有给出镜像时使用的内置程序, 只用到了当前处理器已经实现的指令
+static const uint32_t img[] = {
+  0x00100093,  // addi ra,zero,1
+  0x00208113,  // addi sp,ra,2
+  0xfff10193,  // addi gp,sp,-1
+  0x00000513,  // addi a0,zero,0
+  0x00100073,  // ebreak (used as npc_trap)
+};
+
+bool in_pmem(paddr_t addr) { return addr - MBASE < MSIZE; }
+uint8_t* guest_to_host(paddr_t addr) { return pmem + addr - MBASE; }
+
+word_t paddr_read(paddr_t addr) {
+  if (!in_pmem(addr)) {
+    printf("address = 0x%08x is out of bound of pmem [0x%08x, 0x%08x]\n",
+        addr, MBASE, MBASE + MSIZE - 1);
+    npc_state.state = NPC_ABORT;
+    npc_state.halt_pc = addr;
+    return 0;
+  }
+  word_t data;
+  memcpy(&data, guest_to_host(addr & ~0x3u), 4);
+  return data;
+}
+
+long load_img(const char *img_file) {
+  if (img_file == NULL) {
+    printf("No image is given. Use the default build-in image.\n");
+    memcpy(guest_to_host(RESET_VECTOR), img, sizeof(img));
+    return sizeof(img);
+  }
+
+  FILE *fp = fopen(img_file, "rb");
+  if (fp == NULL) {
+    printf("Can not open '%s'\n", img_file);
+    exit(EXIT_FAILURE);
+  }
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  assert(size <= (long)MSIZE);
+  printf("The image is %s, size = %ld\n", img_file, size);
+
+  fseek(fp, 0, SEEK_SET);
+  int ret = fread(guest_to_host(RESET_VECTOR), size, 1, fp);
+  assert(ret == 1);
+  fclose(fp);
+  return size;
+}
@@ -31,6 +31,14 @@ module IDU (
     end
     //registers
     reg [31:0] regs [0:31];
+    //difftest: expose the register file to the simulator
+    import "DPI-C" function void set_gpr_ptr(input logic [31:0] a []);
+    initial set_gpr_ptr(regs);
+    //ebreak: stop the simulation, a0 is the return value
+    import "DPI-C" function void npc_trap(input int code);
+    always @(posedge clk) begin
+        if (rst_n && inst == 32'h00100073) npc_trap(regs[10]);
+    end
     //output
     assign rs1_data = (rs1 == 0) ? 32'b0 : regs[rs1];
     assign rs2_data = (rs2 == 0) ? 32'b0 : regs[rs2];
@@ -78,4 +78,11 @@ module top(
     // .dmem_rdata()
   );
 
+  // --- 仿真接口 ---
+  // 单周期处理器: 每个时钟上升沿提交一条指令, 通知C++ Testbench进行difftest
+  import "DPI-C" function void npc_commit(input int pc);
+  always @(posedge clk) begin
+    if (rst_n) npc_commit(i_pc);
+  end
+
 endmodule